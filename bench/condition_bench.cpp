@@ -0,0 +1,113 @@
+// bench/condition_bench.cpp
+// Compares the switch that ARM7CPU::check_condition used to be with the condition_table lookup
+// that replaced it (cpu/arm7_cpu.cpp). Both are checked against each other on every input, then
+// timed over the same stream of conditions and flags.
+// Configure with -DBUILD_BENCHMARKS=ON -DCMAKE_BUILD_TYPE=Release and run condition_bench.
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+constexpr uint32_t FLAG_N = (1 << 31);
+constexpr uint32_t FLAG_Z = (1 << 30);
+constexpr uint32_t FLAG_C = (1 << 29);
+constexpr uint32_t FLAG_V = (1 << 28);
+
+// The per-condition switch on CPSR bits
+__attribute__((noinline)) static bool check_switch(uint32_t cpsr, uint32_t condition) {
+    switch (condition) {
+        case 0x0: return (cpsr & FLAG_Z) != 0;                // EQ - Equal
+        case 0x1: return (cpsr & FLAG_Z) == 0;                // NE - Not Equal
+        case 0x2: return (cpsr & FLAG_C) != 0;                // CS - Carry Set
+        case 0x3: return (cpsr & FLAG_C) == 0;                // CC - Carry Clear
+        case 0x4: return (cpsr & FLAG_N) != 0;                // MI - Minus
+        case 0x5: return (cpsr & FLAG_N) == 0;                // PL - Plus
+        case 0x6: return (cpsr & FLAG_V) != 0;                // VS - Overflow Set
+        case 0x7: return (cpsr & FLAG_V) == 0;                // VC - Overflow Clear
+        case 0x8: return (cpsr & FLAG_C) && !(cpsr & FLAG_Z); // HI - Higher
+        case 0x9: return !(cpsr & FLAG_C) || (cpsr & FLAG_Z); // LS - Lower or Same
+        case 0xA: return !!(cpsr & FLAG_N) == !!(cpsr & FLAG_V); // GE - Greater or Equal
+        case 0xB: return !!(cpsr & FLAG_N) != !!(cpsr & FLAG_V); // LT - Less Than
+        case 0xC: return !(cpsr & FLAG_Z) && (!!(cpsr & FLAG_N) == !!(cpsr & FLAG_V)); // GT - Greater Than
+        case 0xD: return (cpsr & FLAG_Z) || (!!(cpsr & FLAG_N) != !!(cpsr & FLAG_V));  // LE - Less or Equal
+        case 0xE: return true;                        // AL - Always
+        case 0xF: return false;                       // NV - Never
+        default: return false;
+    }
+}
+
+// Same construction as condition_table in cpu/arm7_cpu.cpp
+constexpr std::array<uint16_t, 16> condition_table = [] {
+    std::array<uint16_t, 16> table{};
+    for (uint32_t nzcv = 0; nzcv < 16; nzcv++) {
+        const bool n = nzcv & 8;
+        const bool z = nzcv & 4;
+        const bool c = nzcv & 2;
+        const bool v = nzcv & 1;
+        const bool passes[16] = {
+            z, !z, c, !c, n, !n, v, !v, c && !z, !c || z, n == v, n != v, !z && n == v, z || n != v, true, false
+        };
+        for (uint32_t condition = 0; condition < 16; condition++) {
+            if (passes[condition]) table[condition] |= 1 << nzcv;
+        }
+    }
+    return table;
+}();
+
+__attribute__((noinline)) static bool check_table(uint32_t cpsr, uint32_t condition) {
+    return (condition_table[condition] >> (cpsr >> 28)) & 1;
+}
+
+struct ConditionCheck {
+    uint32_t cpsr;
+    uint32_t condition;
+};
+
+template <bool (*Checker)(uint32_t, uint32_t)>
+static double time_checks(const std::vector<ConditionCheck>& checks, int rounds, uint32_t& passed) {
+    const auto start = std::chrono::steady_clock::now();
+    passed = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (const ConditionCheck& check : checks) {
+            passed += Checker(check.cpsr, check.condition);
+        }
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (static_cast<double>(checks.size()) * rounds);
+}
+
+int main() {
+    // Most ARM code is unconditional; the rest uses a random condition. Flags are random.
+    constexpr size_t CHECK_COUNT = 1 << 20;
+    constexpr int ROUNDS = 20;
+    std::mt19937 random(12345);
+    std::vector<ConditionCheck> checks(CHECK_COUNT);
+    for (ConditionCheck& check : checks) {
+        check.cpsr = (random() & 0xF) << 28;
+        check.condition = (random() % 4 == 0) ? random() & 0xF : 0xE;
+    }
+
+    for (uint32_t nzcv = 0; nzcv < 16; nzcv++) {
+        for (uint32_t condition = 0; condition < 16; condition++) {
+            if (check_switch(nzcv << 28, condition) != check_table(nzcv << 28, condition)) {
+                std::printf("Mismatch: condition %X with NZCV %X\n", condition, nzcv);
+                return 1;
+            }
+        }
+    }
+
+    uint32_t switch_passed;
+    uint32_t table_passed;
+    const double switch_ns = time_checks<check_switch>(checks, ROUNDS, switch_passed);
+    const double table_ns = time_checks<check_table>(checks, ROUNDS, table_passed);
+    if (switch_passed != table_passed) {
+        std::printf("Mismatch: %u passed with the switch, %u with the table\n", switch_passed, table_passed);
+        return 1;
+    }
+
+    std::printf("switch: %.2f ns/check\n", switch_ns);
+    std::printf("table:  %.2f ns/check\n", table_ns);
+    return 0;
+}
@@ -0,0 +1,82 @@
+// cpu/alu.h
+#pragma once
+
+#include "../memory/memory.h"
+#include <bit>
+#include <cstdint>
+
+// ALU and memory helpers shared by the ARM and Thumb instruction handlers
+
+// Barrel shifter, specialized on the shift type and on whether the amount is an immediate.
+// carry holds the current C flag on entry; the carry-out is only computed when WithCarry is set,
+// except for RRX which always consumes it.
+template <uint32_t Type, bool Immediate, bool WithCarry>
+inline uint32_t shift_operand(uint32_t value, uint32_t amount, bool& carry) {
+    if (amount == 0) {
+        if constexpr (!Immediate || Type == 0) {
+            return value;
+        } else if constexpr (Type == 1) {
+            // LSR #32
+            if constexpr (WithCarry) carry = value >> 31;
+            return 0;
+        } else if constexpr (Type == 2) {
+            // ASR #32
+            if constexpr (WithCarry) carry = value >> 31;
+            return static_cast<uint32_t>(static_cast<int32_t>(value) >> 31);
+        } else {
+            // RRX
+            const uint32_t result = (static_cast<uint32_t>(carry) << 31) | (value >> 1);
+            if constexpr (WithCarry) carry = value & 1;
+            return result;
+        }
+    }
+
+    // Immediate amounts are 1-31 here; register amounts can be anything up to 255
+    if constexpr (Type == 0) {
+        // LSL
+        if (Immediate || amount < 32) {
+            if constexpr (WithCarry) carry = (value >> (32 - amount)) & 1;
+            return value << amount;
+        }
+        if constexpr (WithCarry) carry = (amount == 32) && (value & 1);
+        return 0;
+    } else if constexpr (Type == 1) {
+        // LSR
+        if (Immediate || amount < 32) {
+            if constexpr (WithCarry) carry = (value >> (amount - 1)) & 1;
+            return value >> amount;
+        }
+        if constexpr (WithCarry) carry = (amount == 32) && (value >> 31);
+        return 0;
+    } else if constexpr (Type == 2) {
+        // ASR
+        if (Immediate || amount < 32) {
+            if constexpr (WithCarry) carry = (static_cast<int32_t>(value) >> (amount - 1)) & 1;
+            return static_cast<uint32_t>(static_cast<int32_t>(value) >> amount);
+        }
+        if constexpr (WithCarry) carry = value >> 31;
+        return static_cast<uint32_t>(static_cast<int32_t>(value) >> 31);
+    } else {
+        // ROR
+        amount &= 31;
+        if (!Immediate && amount == 0) {
+            if constexpr (WithCarry) carry = value >> 31;
+            return value;
+        }
+        if constexpr (WithCarry) carry = (value >> (amount - 1)) & 1;
+        return std::rotr(value, amount);
+    }
+}
+
+// Unaligned word loads rotate the addressed byte into the low bits
+inline uint32_t read_word_rotated(const GBAMemory& memory, uint32_t address) {
+    return std::rotr(memory.read32(address), (address & 3) * 8);
+}
+
+// Internal multiply cycles depend on how many significant bytes the multiplier has
+inline int multiply_cycles(uint32_t multiplier) {
+    if ((multiplier >> 8) == 0 || (multiplier >> 8) == 0xFFFFFF) return 1;
+    if ((multiplier >> 16) == 0 || (multiplier >> 16) == 0xFFFF) return 2;
+    if ((multiplier >> 24) == 0 || (multiplier >> 24) == 0xFF) return 3;
+    return 4;
+}
@@ -3,50 +3,183 @@
 #include "../system.h"
 #include <iostream>
 
+// condition_table[cond] has bit n set when the condition passes for NZCV nibble n
+constexpr std::array<uint16_t, 16> condition_table = [] {
+    std::array<uint16_t, 16> table{};
+    for (uint32_t nzcv = 0; nzcv < 16; nzcv++) {
+        const bool n = nzcv & 8;
+        const bool z = nzcv & 4;
+        const bool c = nzcv & 2;
+        const bool v = nzcv & 1;
+        const bool passes[16] = {
+            z,                 // EQ - Equal
+            !z,                // NE - Not Equal
+            c,                 // CS - Carry Set
+            !c,                // CC - Carry Clear
+            n,                 // MI - Minus
+            !n,                // PL - Plus
+            v,                 // VS - Overflow Set
+            !v,                // VC - Overflow Clear
+            c && !z,           // HI - Higher
+            !c || z,           // LS - Lower or Same
+            n == v,            // GE - Greater or Equal
+            n != v,            // LT - Less Than
+            !z && n == v,      // GT - Greater Than
+            z || n != v,       // LE - Less or Equal
+            true,              // AL - Always
+            false              // NV - Never
+        };
+        for (uint32_t condition = 0; condition < 16; condition++) {
+            if (passes[condition]) table[condition] |= 1 << nzcv;
+        }
+    }
+    return table;
+}();
+
+// Conditions that read C or V (CS, CC, VS, VC and HI to LE); the rest only need N and Z
+constexpr uint16_t CONDITIONS_USING_CV = 0x3FCC;
+
 void ARM7CPU::init() {
     reset();
 }
 
 void ARM7CPU::reset() {
-    registers.fill(0);
+    registers.reset();
     registers[15] = 0x08000000;  // PC starts at ROM
     cpsr = static_cast<uint32_t>(CpuMode::SYSTEM);
+    flags.load(cpsr);
     spsr.fill(0);
-    banked_r13.fill(0);
-    banked_r14.fill(0);
-    banked_r8_r12.fill(0);
     thumb_mode = false;
     cycles = 0;
+    power_state = PowerState::RUNNING;
+    intr_wait_resumed = false;
+    block_cache.clear();
+    reset_native();
+    code_invalidated = false;
+
+    // The first step fills the pipeline from the reset PC
+    pipeline.fill(0);
+    pipeline_flushed = true;
+    fetch_base = nullptr;
+    fetch_start = 0;
+    fetch_size = 0;
 
     // Initialize stack pointers for different modes
     // These are typical GBA stack pointer values
-    banked_r13[get_mode_index(CpuMode::USER)] = 0x03007F00;       // User/System mode SP
-    banked_r13[get_mode_index(CpuMode::IRQ)] = 0x03007FA0;        // IRQ mode SP
-    banked_r13[get_mode_index(CpuMode::FIQ)] = 0x03007FE0;        // FIQ mode SP
-    banked_r13[get_mode_index(CpuMode::SUPERVISOR)] = 0x03007FE0; // Supervisor mode SP
-    banked_r13[get_mode_index(CpuMode::ABORT)] = 0x03007FE0;      // Abort mode SP
-    banked_r13[get_mode_index(CpuMode::UNDEFINED)] = 0x03007FE0;  // Undefined mode SP
+    registers.banked(get_mode_index(CpuMode::USER), 13) = 0x03007F00;       // User/System mode SP
+    registers.banked(get_mode_index(CpuMode::IRQ), 13) = 0x03007FA0;        // IRQ mode SP
+    registers.banked(get_mode_index(CpuMode::FIQ), 13) = 0x03007FE0;        // FIQ mode SP
+    registers.banked(get_mode_index(CpuMode::SUPERVISOR), 13) = 0x03007FE0; // Supervisor mode SP
+    registers.banked(get_mode_index(CpuMode::ABORT), 13) = 0x03007FE0;      // Abort mode SP
+    registers.banked(get_mode_index(CpuMode::UNDEFINED), 13) = 0x03007FE0;  // Undefined mode SP
 }
 
 void ARM7CPU::step(GBASystem& gba) {
+    // A branch in the previous step (or a reset) left the target in R15
+    if (pipeline_flushed) {
+        refill_pipeline(gba);
+    }
+
     // Check if IRQs are enabled and if there are pending interrupts
     if (!(cpsr & FLAG_I) && gba.has_pending_interrupts()) {
         handle_irq(gba);
         return;
     }
 
+    // Execute the oldest prefetched opcode; R15 already reads as its address plus 8 (or 4)
+    const uint32_t instruction = pipeline[0];
+    #ifdef DEBUG_TRACE
+    trace.record(registers[15] - (thumb_mode ? 4 : 8), instruction, get_cpsr(), static_cast<uint32_t>(cycles));
+    #endif
     if (thumb_mode) {
-        uint16_t instruction = gba.memory.read16(registers[15]);
-        registers[15] += 2;
-        execute_thumb(gba, instruction);
+        execute_thumb(gba, static_cast<uint16_t>(instruction));
     } else {
-        uint32_t instruction = gba.memory.read32(registers[15]);
-        registers[15] += 4;
         execute_arm(gba, instruction);
     }
+
+    // Sequential execution reuses the word already in the decode stage
+    if (!pipeline_flushed) {
+        pipeline[0] = pipeline[1];
+        if (thumb_mode) {
+            pipeline[1] = fetch16(gba, registers[15]);
+            registers[15] += 2;
+        } else {
+            pipeline[1] = fetch32(gba, registers[15]);
+            registers[15] += 4;
+        }
+    }
     cycles++;
 }
 
+int ARM7CPU::run(GBASystem& gba, int budget) {
+    // Interrupts are only requested between slices, so a CPU that is not woken at the start of
+    // one sleeps through all of it
+    if (power_state != PowerState::RUNNING) {
+        const bool woken = power_state == PowerState::INTR_WAIT ? resume_intr_wait(gba) : gba.wakes_cpu();
+        if (!woken) {
+            cycles += budget;
+            return budget;
+        }
+        power_state = PowerState::RUNNING;
+    }
+
+    idle_arrival = NO_IDLE_ARRIVAL;
+    if (execution_mode != ExecutionMode::INTERPRETER) {
+        return run_cached(gba, budget);
+    }
+    return run_interpreter(gba, budget);
+}
+
+#ifndef THREADED_INTERPRETER
+int ARM7CPU::run_interpreter(GBASystem& gba, int budget) {
+    const uint64_t start = cycles;
+    const uint64_t deadline = cycles + budget;
+    yield_requested = false;
+
+    // Only I/O writes (which yield) and PPU events (between slices) change the IRQ line,
+    // so it is sampled once; the I flag is still checked before every instruction.
+    const bool irq_line = gba.has_pending_interrupts();
+
+    while (cycles < deadline) {
+        if (pipeline_flushed) {
+            if (!idle_loop_addresses.empty() && skip_configured_idle_loop(registers[15], deadline)) break;
+            refill_pipeline(gba);
+        }
+
+        if (irq_line && !(cpsr & FLAG_I)) {
+            handle_irq(gba);
+            break;
+        }
+
+        const uint32_t instruction = pipeline[0];
+        #ifdef DEBUG_TRACE
+        trace.record(registers[15] - (thumb_mode ? 4 : 8), instruction, get_cpsr(), static_cast<uint32_t>(cycles));
+        #endif
+        if (thumb_mode) {
+            execute_thumb(gba, static_cast<uint16_t>(instruction));
+        } else {
+            execute_arm(gba, instruction);
+        }
+
+        if (!pipeline_flushed) {
+            pipeline[0] = pipeline[1];
+            if (thumb_mode) {
+                pipeline[1] = fetch16(gba, registers[15]);
+                registers[15] += 2;
+            } else {
+                pipeline[1] = fetch32(gba, registers[15]);
+                registers[15] += 4;
+            }
+        }
+        cycles++;
+
+        if (yield_requested) break;
+    }
+
+    return static_cast<int>(cycles - start);
+}
+#endif
+
 void ARM7CPU::handle_irq(GBASystem& gba) {
     #ifdef DEBUG_INTERRUPTS
     std::cout << "CPU: Handling IRQ interrupt" << std::endl;
@@ -55,17 +188,14 @@ void ARM7CPU::handle_irq(GBASystem& gba) {
     CpuMode prior_mode = get_current_mode();
 
     // Save current CPSR to SPSR_irq
-    spsr[get_mode_index(CpuMode::IRQ)] = cpsr;
+    spsr[get_mode_index(CpuMode::IRQ)] = get_cpsr();
 
     // Save return address in LR_irq
-    uint32_t return_address;
-    if (thumb_mode) {
-        return_address = registers[15] - 2;  // Thumb
-    } else {
-        return_address = registers[15] - 4;  // ARM
-    }
+    // LR is the next instruction plus 4 in both states, whether or not the pipeline is filled
+    // (the block engines take IRQs between blocks with it flushed)
+    const uint32_t return_address = program_counter() + 4;
 
-    banked_r14[get_mode_index(CpuMode::IRQ)] = return_address;
+    registers.banked(get_mode_index(CpuMode::IRQ), 14) = return_address;
 
     switch_mode(CpuMode::IRQ);
 
@@ -90,17 +220,12 @@ void ARM7CPU::handle_fiq(GBASystem& gba) {
     CpuMode prior_mode = get_current_mode();
 
     // Save current CPSR to SPSR_fiq
-    spsr[get_mode_index(CpuMode::FIQ)] = cpsr;
+    spsr[get_mode_index(CpuMode::FIQ)] = get_cpsr();
 
     // Save return address in LR_fiq
-    uint32_t return_address;
-    if (thumb_mode) {
-        return_address = registers[15] - 2;
-    } else {
-        return_address = registers[15] - 4;
-    }
+    const uint32_t return_address = program_counter() + 4;
 
-    banked_r14[get_mode_index(CpuMode::FIQ)] = return_address;
+    registers.banked(get_mode_index(CpuMode::FIQ), 14) = return_address;
 
     switch_mode(CpuMode::FIQ);
 
@@ -116,17 +241,9 @@ void ARM7CPU::handle_fiq(GBASystem& gba) {
 }
 
 void ARM7CPU::switch_mode(CpuMode new_mode) {
-    const CpuMode prior_mode = get_current_mode();
-
-    if (prior_mode == new_mode) return;
-
-    save_banked_registers(prior_mode);
-
-    // Update mode bits in CPSR
+    // Update mode bits in CPSR and point R8-R14 at the new mode's bank
     cpsr = (cpsr & ~0x1F) | static_cast<uint32_t>(new_mode);
-
-    // Restore banked registers for new mode
-    restore_banked_registers(new_mode);
+    registers.select_bank(get_mode_index(new_mode));
 }
 
 CpuMode ARM7CPU::get_current_mode() const {
@@ -153,107 +270,109 @@ int ARM7CPU::get_mode_index(CpuMode mode) const {
     }
 }
 
-void ARM7CPU::save_banked_registers(CpuMode prior_mode) {
-    int mode_index = get_mode_index(prior_mode);
+void ARM7CPU::flush_pipeline() {
+    // R15 holds the branch target; the next step refetches from there
+    pipeline_flushed = true;
+}
+
+void ARM7CPU::refill_pipeline(GBASystem& gba) {
+    const uint32_t address = registers[15];
+    if (thumb_mode) {
+        pipeline[0] = fetch16(gba, address);
+        pipeline[1] = fetch16(gba, address + 2);
+        registers[15] = address + 4;
+    } else {
+        pipeline[0] = fetch32(gba, address);
+        pipeline[1] = fetch32(gba, address + 4);
+        registers[15] = address + 8;
+    }
+    pipeline_flushed = false;
+}
 
-    // Save R13 (SP) and R14 (LR)
-    banked_r13[mode_index] = registers[13];
-    banked_r14[mode_index] = registers[14];
+uint32_t ARM7CPU::fetch32(GBASystem& gba, uint32_t address) {
+    uint32_t offset = address - fetch_start;
+    if (offset >= fetch_size) {
+        fetch_base = gba.memory.code_region(address, fetch_start, fetch_size);
+        offset = address - fetch_start;
+        if (offset >= fetch_size) return gba.memory.read32(address);
+    }
+    return *reinterpret_cast<const uint32_t*>(fetch_base + offset);
+}
 
-    // FIQ mode also banks R8-R12
-    if (prior_mode == CpuMode::FIQ) {
-        for (int i = 0; i < 5; i++) {
-            banked_r8_r12[i] = registers[8 + i];
-        }
+uint16_t ARM7CPU::fetch16(GBASystem& gba, uint32_t address) {
+    uint32_t offset = address - fetch_start;
+    if (offset >= fetch_size) {
+        fetch_base = gba.memory.code_region(address, fetch_start, fetch_size);
+        offset = address - fetch_start;
+        if (offset >= fetch_size) return gba.memory.read16(address);
     }
+    return *reinterpret_cast<const uint16_t*>(fetch_base + offset);
 }
 
-void ARM7CPU::restore_banked_registers(CpuMode new_mode) {
-    int mode_index = get_mode_index(new_mode);
+uint32_t& ARM7CPU::user_register(uint32_t reg) {
+    return registers.banked(get_mode_index(CpuMode::USER), reg);
+}
 
-    // Restore R13 (SP) and R14 (LR)
-    registers[13] = banked_r13[mode_index];
-    registers[14] = banked_r14[mode_index];
+bool ARM7CPU::has_spsr() const {
+    const CpuMode mode = get_current_mode();
+    return mode != CpuMode::USER && mode != CpuMode::SYSTEM;
+}
 
-    // FIQ mode also banks R8-R12
-    if (new_mode == CpuMode::FIQ) {
-        for (int i = 0; i < 5; i++) {
-            registers[8 + i] = banked_r8_r12[i];
-        }
-    } else {
-        // Restore normal R8-R12 registers
-        for (int i = 0; i < 5; i++) {
-            registers[8 + i] = banked_r8_r12[5 + i]; // Second half stores normal registers
-        }
+void ARM7CPU::write_cpsr(uint32_t value) {
+    switch_mode(static_cast<CpuMode>(value & 0x1F));
+    cpsr = value;
+    flags.load(value);
+    thumb_mode = (value & FLAG_T) != 0;
+}
+
+void ARM7CPU::restore_cpsr() {
+    // Used by exception returns (MOVS PC, LR / LDM with S bit)
+    if (has_spsr()) {
+        write_cpsr(spsr[get_mode_index(get_current_mode())]);
     }
 }
 
-void ARM7CPU::flush_pipeline() {
-    // TODO: Actually flush the pipeline
+void ARM7CPU::enter_exception(CpuMode mode, uint32_t vector, uint32_t return_address) {
+    const uint32_t saved_cpsr = get_cpsr();
+
+    switch_mode(mode);
+    spsr[get_mode_index(mode)] = saved_cpsr;
+    registers[14] = return_address;
+
+    // Exceptions always run in ARM state with IRQs disabled
+    cpsr |= FLAG_I;
+    cpsr &= ~FLAG_T;
+    thumb_mode = false;
+
+    branch_to(vector);
+}
+
+void ARM7CPU::branch_to(uint32_t address) {
+    registers[15] = address & (thumb_mode ? ~1u : ~3u);
+    flush_pipeline();
+    cycles += 2; // Pipeline refill
 }
 
 void ARM7CPU::execute_arm(GBASystem& gba, uint32_t instruction) {
-    uint32_t condition = (instruction >> 28) & 0xF;
-    if (!check_condition(condition)) {
+    const uint32_t condition = instruction >> 28;
+    if (condition != CONDITION_ALWAYS && !check_condition(condition)) {
         return;
     }
 
-    // TODO: Basic instruction decoding
-    uint32_t opcode = (instruction >> 21) & 0xF;
-
-    if ((instruction & 0x0FB00FF0) == 0x01000090) {
-        // SWP instruction (atomic swap)
-        // TODO: Implement
-        std::cout << "SWP instruction: 0x" << std::hex << instruction << std::endl;
-    } else if ((instruction & 0x0F000000) == 0x0F000000) {
-        // Software Interrupt (SWI)
-        std::cout << "SWI instruction: 0x" << std::hex << instruction << std::endl;
-        // TODO: Handle SWI
-    } else {
-        // TODO: Implement full ARM instruction set
-        std::cout << "ARM instruction: 0x" << std::hex << instruction << std::endl;
-    }
+    arm_table[((instruction >> 16) & 0xFF0) | ((instruction >> 4) & 0xF)](*this, gba, instruction);
 }
 
 void ARM7CPU::execute_thumb(GBASystem& gba, uint16_t instruction) {
-    // TODO: Basic Thumb instruction decoding
-    if ((instruction & 0xFF00) == 0xDF00) {
-        // Software Interrupt in Thumb mode
-        std::cout << "Thumb SWI instruction: 0x" << std::hex << instruction << std::endl;
-        // TODO: Handle Thumb SWI
-    } else {
-        // TODO: Implement full Thumb instruction set
-        std::cout << "Thumb instruction: 0x" << std::hex << instruction << std::endl;
-    }
+    thumb_table[instruction >> 6](*this, gba, instruction);
 }
 
-void ARM7CPU::set_flags(uint32_t result, bool carry, bool overflow) {
-    cpsr &= ~(FLAG_N | FLAG_Z | FLAG_C | FLAG_V);
-
-    if (result == 0) cpsr |= FLAG_Z;
-    if (result & 0x80000000) cpsr |= FLAG_N;
-    if (carry) cpsr |= FLAG_C;
-    if (overflow) cpsr |= FLAG_V;
+uint32_t ARM7CPU::get_cpsr() {
+    cpsr = (cpsr & ~(FLAG_N | FLAG_Z | FLAG_C | FLAG_V)) | (flags.nzcv() << 28);
+    return cpsr;
 }
 
 bool ARM7CPU::check_condition(uint32_t condition) {
-    switch (condition) {
-        case 0x0: return (cpsr & FLAG_Z) != 0;                // EQ - Equal
-        case 0x1: return (cpsr & FLAG_Z) == 0;                // NE - Not Equal
-        case 0x2: return (cpsr & FLAG_C) != 0;                // CS - Carry Set
-        case 0x3: return (cpsr & FLAG_C) == 0;                // CC - Carry Clear
-        case 0x4: return (cpsr & FLAG_N) != 0;                // MI - Minus
-        case 0x5: return (cpsr & FLAG_N) == 0;                // PL - Plus
-        case 0x6: return (cpsr & FLAG_V) != 0;                // VS - Overflow Set
-        case 0x7: return (cpsr & FLAG_V) == 0;                // VC - Overflow Clear
-        case 0x8: return (cpsr & FLAG_C) && !(cpsr & FLAG_Z); // HI - Higher
-        case 0x9: return !(cpsr & FLAG_C) || (cpsr & FLAG_Z); // LS - Lower or Same
-        case 0xA: return !!(cpsr & FLAG_N) == !!(cpsr & FLAG_V); // GE - Greater or Equal
-        case 0xB: return !!(cpsr & FLAG_N) != !!(cpsr & FLAG_V); // LT - Less Than
-        case 0xC: return !(cpsr & FLAG_Z) && (!!(cpsr & FLAG_N) == !!(cpsr & FLAG_V)); // GT - Greater Than
-        case 0xD: return (cpsr & FLAG_Z) || (!!(cpsr & FLAG_N) != !!(cpsr & FLAG_V));  // LE - Less or Equal
-        case 0xE: return true;                        // AL - Always
-        case 0xF: return false;                       // NV - Never
-        default: return false;
-    }
-}
\ No newline at end of file
+    // EQ, NE, MI, PL and AL leave a pending addition's C and V uncomputed
+    const uint32_t nzcv = ((CONDITIONS_USING_CV >> condition) & 1) ? flags.nzcv() : flags.nz();
+    return (condition_table[condition] >> nzcv) & 1;
+}
@@ -3,6 +3,16 @@
 
 #include <array>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include "block_cache.h"
+#include "jit_x64.h"
+#include "rom_predecoder.h"
+
+#ifdef DEBUG_TRACE
+#include "cpu_trace.h"
+#endif
 
 // Forward declaration
 class GBASystem;
@@ -18,6 +28,28 @@ enum class CpuMode : uint32_t {
     SYSTEM = 0x1F
 };
 
+// How run() executes guest code
+enum class ExecutionMode {
+    INTERPRETER,    // Fetch and decode every instruction
+    BLOCK_CACHE,    // Replay pre-decoded basic blocks
+    JIT,            // Run blocks translated to host code (BLOCK_CACHE where unsupported)
+    TIERED          // Interpret cold code, cache warm blocks and translate hot ones
+};
+
+// Low-power states entered by writing HALTCNT
+enum class PowerState {
+    RUNNING,
+    HALT,           // Until any enabled interrupt is requested (IE & IF), even with IME clear
+    STOP,           // Until a keypad, Game Pak or serial interrupt is requested
+    INTR_WAIT       // In an emulated IntrWait, until an IRQ can be taken (bios_hle.cpp)
+};
+
+// Execution counts at which ExecutionMode::TIERED moves code up a tier
+struct TierThresholds {
+    uint32_t block_cache = 1;   // Interpreted entries to an address before its block is decoded
+    uint32_t jit = 64;          // Cached executions of a block before it is translated
+};
+
 // CPU State Flags
 constexpr uint32_t FLAG_N = (1 << 31);  // Negative
 constexpr uint32_t FLAG_Z = (1 << 30);  // Zero
@@ -27,6 +59,87 @@ constexpr uint32_t FLAG_I = (1 << 7);   // IRQ disable
 constexpr uint32_t FLAG_F = (1 << 6);   // FIQ disable
 constexpr uint32_t FLAG_T = (1 << 5);   // Thumb mode
 
+// Condition field of instructions that always execute
+constexpr uint32_t CONDITION_ALWAYS = 0xE;
+
+// Lazily evaluated NZCV. Flag-setting instructions only record their result (and, for
+// additions, the operands); the flags are derived when something actually reads them.
+struct LazyFlags {
+    uint32_t n_source = 0;      // N = bit 31
+    uint32_t z_source = 1;      // Z = (z_source == 0)
+    bool carry = false;
+    bool overflow = false;
+
+    // C and V of the last addition are computed from its operands on demand
+    bool add_pending = false;
+    bool add_carry_in = false;
+    uint32_t add_lhs = 0;
+    uint32_t add_rhs = 0;
+
+    // lhs + rhs + carry_in with full NZCV. Subtraction is lhs + ~rhs + 1.
+    uint32_t add(uint32_t lhs, uint32_t rhs, bool carry_in) {
+        const uint32_t result = lhs + rhs + carry_in;
+        n_source = z_source = result;
+        add_lhs = lhs;
+        add_rhs = rhs;
+        add_carry_in = carry_in;
+        add_pending = true;
+        return result;
+    }
+
+    // Logical operations: N, Z and C; V is preserved
+    void set_logic(uint32_t result, bool shifter_carry) {
+        resolve();
+        n_source = z_source = result;
+        carry = shifter_carry;
+    }
+
+    // Multiplies and Thumb logical operations: N and Z only
+    void set_nz(uint32_t result) {
+        n_source = z_source = result;
+    }
+
+    void set_nz64(uint64_t result) {
+        n_source = static_cast<uint32_t>(result >> 32);
+        z_source = static_cast<uint32_t>(result >> 32) | static_cast<uint32_t>(result != 0);
+    }
+
+    bool c() const {
+        if (!add_pending) return carry;
+        const uint32_t result = add_lhs + add_rhs + add_carry_in;
+        return add_carry_in ? result <= add_lhs : result < add_lhs;
+    }
+
+    // Fold a pending addition into the explicit C and V bits
+    void resolve() {
+        if (!add_pending) return;
+        const uint32_t result = add_lhs + add_rhs + add_carry_in;
+        carry = add_carry_in ? result <= add_lhs : result < add_lhs;
+        overflow = ((~(add_lhs ^ add_rhs) & (add_lhs ^ result)) >> 31) != 0;
+        add_pending = false;
+    }
+
+    // N and Z in NZCV nibble position, leaving a pending addition unresolved
+    uint32_t nz() const {
+        return ((n_source >> 31) << 3) | (static_cast<uint32_t>(z_source == 0) << 2);
+    }
+
+    // NZCV as a nibble (N in bit 3)
+    uint32_t nzcv() {
+        resolve();
+        return ((n_source >> 31) << 3) | (static_cast<uint32_t>(z_source == 0) << 2) |
+               (static_cast<uint32_t>(carry) << 1) | static_cast<uint32_t>(overflow);
+    }
+
+    void load(uint32_t psr) {
+        n_source = psr & FLAG_N;
+        z_source = (psr & FLAG_Z) ? 0 : 1;
+        carry = (psr & FLAG_C) != 0;
+        overflow = (psr & FLAG_V) != 0;
+        add_pending = false;
+    }
+};
+
 // Exception Vector Addresses
 constexpr uint32_t VECTOR_RESET = 0x00000000;
 constexpr uint32_t VECTOR_UNDEFINED = 0x00000004;
@@ -36,24 +149,128 @@ constexpr uint32_t VECTOR_DATA_ABORT = 0x00000010;
 constexpr uint32_t VECTOR_IRQ = 0x00000018;
 constexpr uint32_t VECTOR_FIQ = 0x0000001C;
 
+// Banked register file. Physical slots 0-15 are the User/System R0-R15, 16-22 the FIQ R8-R14,
+// and 23-30 the R13/R14 pairs of IRQ, Supervisor, Abort and Undefined. A mode switch only
+// swaps the 16-entry index map, so no register values are copied.
+class RegisterFile {
+    friend class JitCompiler;
+    friend class JitTranslator;
+
+public:
+    // Bank numbers follow ARM7CPU::get_mode_index
+    static constexpr std::array<std::array<uint8_t, 16>, 6> bank_maps = {{
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},     // User/System
+        {0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22, 15},   // FIQ
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 23, 24, 15},     // IRQ
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 25, 26, 15},     // Supervisor
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 27, 28, 15},     // Abort
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 29, 30, 15},     // Undefined
+    }};
+
+    uint32_t& operator[](uint32_t reg) { return physical[map[reg]]; }
+    uint32_t operator[](uint32_t reg) const { return physical[map[reg]]; }
+
+    // Register as seen from another bank; bank 0 is the User/System view
+    uint32_t& banked(int bank, uint32_t reg) { return physical[bank_maps[bank][reg]]; }
+
+    void select_bank(int bank) { map = bank_maps[bank]; }
+
+    void reset() {
+        physical.fill(0);
+        map = bank_maps[0];
+    }
+
+private:
+    std::array<uint32_t, 31> physical{};
+    std::array<uint8_t, 16> map = bank_maps[0];
+};
+
 // ARM7TDMI CPU Class
 class ARM7CPU {
+    friend class JitCompiler;
+    friend class JitTranslator;
+    friend class RomPredecoder;
+
 public:
-    std::array<uint32_t, 16> registers{};     // R0-R15 (R15 is PC)
-    uint32_t cpsr = 0;                        // Current Program Status Register
-    std::array<uint32_t, 5> spsr{};           // Saved Program Status Registers
-    std::array<uint32_t, 6> banked_r13{};     // Banked R13 (SP) registers
-    std::array<uint32_t, 6> banked_r14{};     // Banked R14 (LR) registers
-    std::array<uint32_t, 10> banked_r8_r12{}; // Banked R8-R12 for FIQ mode
+    // ARM instruction handlers are indexed by bits 27-20 and 7-4 of the opcode
+    using ArmHandler = void (*)(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    // Thumb instruction handlers are indexed by bits 15-6 of the opcode
+    using ThumbHandler = void (*)(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+
+    RegisterFile registers;                   // R0-R15 of the current mode (R15 is PC)
+    uint32_t cpsr = 0;                        // Current Program Status Register (NZCV live in flags)
+    LazyFlags flags;                          // Condition flags, folded into cpsr by get_cpsr()
+    std::array<uint32_t, 6> spsr{};           // Saved Program Status Registers (indexed by mode)
     bool thumb_mode = false;
-    int cycles = 0;
+    uint64_t cycles = 0;
+    bool yield_requested = false;             // Set by timing-relevant I/O writes to end run() early
+    PowerState power_state = PowerState::RUNNING;
+
+    ExecutionMode execution_mode = ExecutionMode::INTERPRETER;
+    BlockCache block_cache;                   // Decoded blocks for ExecutionMode::BLOCK_CACHE, JIT and TIERED
+    TierThresholds tier_thresholds;
+    size_t jit_cache_budget = JIT_BUFFER_SIZE;    // Bytes of translated code kept before evicting
+    bool jit_share_rom_code = false;              // Share ROM translations with other instances of the same ROM in this process
+
+    // Translation cache counters; all zero when the JIT has not run
+    JitCacheStats jit_stats() const;
+
+    // Keep decoded ROM blocks, their tiering counters and optionally their translations across
+    // runs (code_cache_file.cpp). The file in directory is named after the ROM hash; translations
+    // written by a different build are skipped.
+    bool save_code_cache(GBASystem& gba, const std::string& directory, bool include_native = false);
+    bool load_code_cache(GBASystem& gba, const std::string& directory);
+
+    // Decode the ROM code reachable from the entry point on a worker thread (rom_predecoder.cpp),
+    // translating it too in ExecutionMode::JIT. run() picks the blocks up as they are found.
+    // GBASystem::load_rom() starts this when predecode_rom is set.
+    bool predecode_rom = false;
+    void start_predecode(GBASystem& gba);
+    void stop_predecode();
+
+    // Loops that only wait for an interrupt or PPU event skip to the end of the run() slice.
+    // Blocks that branch to themselves are checked automatically (idle_loop.h) in all but
+    // ExecutionMode::INTERPRETER; addresses listed here (loaded per ROM by
+    // GBASystem::load_idle_loops()) are trusted in every mode, for loops the check cannot prove.
+    // Neither kind is translated (translatable()), so every entry reaches the check.
+    std::unordered_set<uint32_t> idle_loop_addresses;
+    uint64_t idle_cycles_skipped = 0;
+
+    // Execute IntrWait, VBlankIntrWait, the math calls (Div, DivArm, Sqrt, ArcTan, ArcTan2) and
+    // the decompressors (bios_decompress.h) natively instead of entering the SWI vector
+    // (bios_hle.cpp). Without a BIOS image, GBASystem::load_rom() then also installs the BIOS IRQ
+    // dispatcher, which game IRQ handlers need and IntrWait relies on.
+    bool hle_bios = false;
+    void install_hle_bios(GBASystem& gba);
+
+    // Run the math calls on known inputs and check R0, R1 and R3 against the expected results,
+    // printing any mismatch (main.cpp --selftest)
+    static bool hle_math_selftest();
+
+    // Called by GBAMemory when a page holding cached code is written
+    void invalidate_code(uint32_t address);
+
+#ifdef DEBUG_TRACE
+    TraceBuffer trace;                        // Recent (PC, opcode, CPSR, cycle) history
+#endif
 
     void init();
     void reset();
     void step(GBASystem& gba);
+
+    // Execute until budget cycles have elapsed, an interrupt is taken or yield_requested is set.
+    // Returns the cycles actually used (the last instruction may overshoot the budget). While
+    // halted or stopped the whole budget passes without executing anything.
+    int run(GBASystem& gba, int budget);
     void execute_arm(GBASystem& gba, uint32_t instruction);
     void execute_thumb(GBASystem& gba, uint16_t instruction);
 
+    // CPSR with the current condition flags folded in
+    uint32_t get_cpsr();
+
+    // Address of the next instruction to execute, whether or not the pipeline is filled
+    uint32_t program_counter() const { return pipeline_flushed ? registers[15] : registers[15] - (thumb_mode ? 4 : 8); }
+
     // Interrupt handling
     void handle_irq(GBASystem& gba);
     void handle_fiq(GBASystem& gba);
@@ -63,13 +280,142 @@ private:
     void switch_mode(CpuMode new_mode);
     CpuMode get_current_mode() const;
     int get_mode_index(CpuMode mode) const;
-    void save_banked_registers(CpuMode prior_mode);
-    void restore_banked_registers(CpuMode new_mode);
+
+    uint32_t& user_register(uint32_t reg);
+    bool has_spsr() const;
+    void write_cpsr(uint32_t value);
+    void restore_cpsr();
+    void enter_exception(CpuMode mode, uint32_t vector, uint32_t return_address);
 
     // Helper functions for instruction decoding
-    void set_flags(uint32_t result, bool carry = false, bool overflow = false);
     bool check_condition(uint32_t condition);
 
+    // Execution engines behind run()
+    int run_interpreter(GBASystem& gba, int budget);
+    int run_cached(GBASystem& gba, int budget);
+
+    // Basic block cache (cached_interpreter.cpp)
+    CachedBlock* build_block(GBASystem& gba, uint32_t address);
+    // Decode the block at address from a code region's host memory; false if it has no instructions
+    static bool decode_block(const uint8_t* region, uint32_t region_start, uint32_t region_size, uint32_t address,
+                             bool thumb, CachedBlock& block);
+    void execute_block(GBASystem& gba, const CachedBlock& block);
+    void interpret_until_branch(GBASystem& gba, uint64_t deadline);
+    bool code_invalidated = false;            // Cached code was dropped; stop replaying the current block
+
+    // Idle loop fast-forward (cached_interpreter.cpp)
+    void skip_idle_iterations(uint64_t deadline, uint64_t period);
+    bool skip_configured_idle_loop(uint32_t address, uint64_t deadline);
+    static constexpr uint32_t NO_IDLE_ARRIVAL = ~0u;
+    uint32_t idle_arrival = NO_IDLE_ARRIVAL;  // Configured idle loop already reached this slice
+    uint64_t idle_arrival_cycles = 0;
+
+    // False for idle loops: with no native code they are never link targets, so translated
+    // blocks leaving for them return to run_cached() rather than chaining in
+    bool translatable(const CachedBlock& block) const {
+        return !block.idle_loop && !idle_loop_addresses.contains(block.start);
+    }
+
+    // Native translation of cached blocks (jit_x64.cpp)
+    bool prepare_jit(GBASystem& gba);
+    bool execute_native(CachedBlock& block);
+    void unlink_native(uint32_t address);     // Before the blocks decoded from a page are dropped
+    void reset_native();
+    std::unique_ptr<JitCompiler> jit;
+    JitContext jit_context;
+
+    // BIOS calls (bios_hle.cpp); hle_swi() is false for functions left to the BIOS
+    bool hle_swi(GBASystem& gba, uint32_t function);
+    void hle_intr_wait(GBASystem& gba, bool discard, uint16_t wait_flags);
+    bool resume_intr_wait(GBASystem& gba);
+    uint32_t intr_wait_address = 0;           // The waiting SWI, executed again after each IRQ
+    bool intr_wait_resumed = false;           // Set while that IRQ runs, so old flags are kept
+
+    // Background ROM decoding (rom_predecoder.cpp)
+    void merge_predecoded(bool native);
+    std::unique_ptr<RomPredecoder> predecoder;
+
+    // R15 reads as the current instruction address plus 8 (ARM) or 4 (Thumb)
+    uint32_t next_instruction_address() const { return registers[15] - (thumb_mode ? 2 : 4); }
+    void branch_to(uint32_t address);
+
     // Pipeline management
     void flush_pipeline();
+    void refill_pipeline(GBASystem& gba);
+    uint32_t fetch32(GBASystem& gba, uint32_t address);
+    uint16_t fetch16(GBASystem& gba, uint32_t address);
+
+    // Prefetched opcodes: [0] is the next to execute, [1] the one behind it
+    std::array<uint32_t, 2> pipeline{};
+    bool pipeline_flushed = true;
+
+    // Host memory backing the current code region, so sequential fetches skip the region lookup
+    const uint8_t* fetch_base = nullptr;
+    uint32_t fetch_start = 0;
+    uint32_t fetch_size = 0;
+
+    // ARM instruction handlers (arm_instructions.cpp; the template in arm_instructions.h)
+    template <uint32_t Opcode, bool SetFlags, bool Immediate, uint32_t ShiftType, bool RegisterShift>
+    static void arm_data_processing(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_mrs(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_msr(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_multiply(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_multiply_long(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_swap(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_branch_exchange(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_halfword_transfer(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_single_transfer(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_block_transfer(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_branch(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_software_interrupt(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+    static void arm_undefined(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+
+    // Handler number for an arm_table index, and the handler with a given number (arm_instructions.h)
+    static constexpr uint32_t arm_handler_id(uint32_t index);
+    template <uint32_t Id>
+    static constexpr ArmHandler arm_handler();
+    static const std::array<ArmHandler, 4096> arm_table;
+
+    // Thumb instruction handlers (thumb_instructions.h), specialized on the fields in bits 15-6
+    template <uint32_t Op, uint32_t Offset>
+    static void thumb_move_shifted(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Immediate, bool Subtract, uint32_t Operand>
+    static void thumb_add_subtract(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <uint32_t Op, uint32_t Rd>
+    static void thumb_immediate(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <uint32_t Op>
+    static void thumb_alu(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <uint32_t Op, bool HighRd, bool HighRs>
+    static void thumb_hi_register(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <uint32_t Rd>
+    static void thumb_pc_relative_load(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Load, bool Byte, uint32_t Ro>
+    static void thumb_register_offset(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Halfword, bool SignExtend, uint32_t Ro>
+    static void thumb_sign_extended(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Byte, bool Load, uint32_t Offset>
+    static void thumb_immediate_offset(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Load, uint32_t Offset>
+    static void thumb_halfword_offset(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Load, uint32_t Rd>
+    static void thumb_sp_relative(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool FromSp, uint32_t Rd>
+    static void thumb_load_address(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Negative>
+    static void thumb_adjust_sp(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Load, bool PcLr>
+    static void thumb_push_pop(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Load, uint32_t Rb>
+    static void thumb_multiple(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <uint32_t Condition>
+    static void thumb_conditional_branch(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    static void thumb_software_interrupt(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    static void thumb_branch(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    template <bool Second>
+    static void thumb_long_branch(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    static void thumb_undefined(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+
+    template <uint32_t Index>
+    static constexpr ThumbHandler decode_thumb();
+    static const std::array<ThumbHandler, 1024> thumb_table;
 };
\ No newline at end of file
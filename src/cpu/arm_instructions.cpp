@@ -0,0 +1,338 @@
+// cpu/arm_instructions.cpp
+#include "arm_instructions.h"
+#include <bit>
+#include <utility>
+
+void ARM7CPU::arm_mrs(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const uint32_t rd = (instruction >> 12) & 0xF;
+
+    if ((instruction & (1 << 22)) && cpu.has_spsr()) {
+        cpu.registers[rd] = cpu.spsr[cpu.get_mode_index(cpu.get_current_mode())];
+    } else {
+        cpu.registers[rd] = cpu.get_cpsr();
+    }
+}
+
+void ARM7CPU::arm_msr(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    uint32_t value;
+    if (instruction & (1 << 25)) {
+        value = std::rotr(instruction & 0xFF, ((instruction >> 8) & 0xF) * 2);
+    } else {
+        value = cpu.registers[instruction & 0xF];
+    }
+
+    // Field mask: f (flags), s (status), x (extension), c (control)
+    uint32_t mask = 0;
+    if (instruction & (1 << 19)) mask |= 0xFF000000;
+    if (instruction & (1 << 18)) mask |= 0x00FF0000;
+    if (instruction & (1 << 17)) mask |= 0x0000FF00;
+    if (instruction & (1 << 16)) mask |= 0x000000FF;
+
+    if (instruction & (1 << 22)) {
+        if (cpu.has_spsr()) {
+            uint32_t& saved = cpu.spsr[cpu.get_mode_index(cpu.get_current_mode())];
+            saved = (saved & ~mask) | (value & mask);
+        }
+        return;
+    }
+
+    // User mode may only change the condition flags, and MSR never changes the T bit
+    if (cpu.get_current_mode() == CpuMode::USER) mask &= 0xFF000000;
+    mask &= ~FLAG_T;
+
+    cpu.write_cpsr((cpu.get_cpsr() & ~mask) | (value & mask));
+}
+
+void ARM7CPU::arm_multiply(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const uint32_t rd = (instruction >> 16) & 0xF;
+    const uint32_t rs = cpu.registers[(instruction >> 8) & 0xF];
+
+    uint32_t result = cpu.registers[instruction & 0xF] * rs;
+    if (instruction & (1 << 21)) {
+        // MLA
+        result += cpu.registers[(instruction >> 12) & 0xF];
+        cpu.cycles++;
+    }
+
+    cpu.registers[rd] = result;
+    if (instruction & (1 << 20)) {
+        cpu.flags.set_nz(result);
+    }
+
+    cpu.cycles += multiply_cycles(rs);
+}
+
+void ARM7CPU::arm_multiply_long(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const uint32_t rd_hi = (instruction >> 16) & 0xF;
+    const uint32_t rd_lo = (instruction >> 12) & 0xF;
+    const uint32_t rs = cpu.registers[(instruction >> 8) & 0xF];
+    const uint32_t rm = cpu.registers[instruction & 0xF];
+
+    uint64_t result;
+    if (instruction & (1 << 22)) {
+        // SMULL/SMLAL
+        result = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(rm)) *
+                                       static_cast<int32_t>(rs));
+    } else {
+        // UMULL/UMLAL
+        result = static_cast<uint64_t>(rm) * rs;
+    }
+
+    if (instruction & (1 << 21)) {
+        result += (static_cast<uint64_t>(cpu.registers[rd_hi]) << 32) | cpu.registers[rd_lo];
+        cpu.cycles++;
+    }
+
+    cpu.registers[rd_lo] = static_cast<uint32_t>(result);
+    cpu.registers[rd_hi] = static_cast<uint32_t>(result >> 32);
+
+    if (instruction & (1 << 20)) {
+        cpu.flags.set_nz64(result);
+    }
+
+    cpu.cycles += multiply_cycles(rs) + 1;
+}
+
+void ARM7CPU::arm_swap(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const uint32_t address = cpu.registers[(instruction >> 16) & 0xF];
+    const uint32_t rd = (instruction >> 12) & 0xF;
+    const uint32_t source = cpu.registers[instruction & 0xF];
+
+    uint32_t value;
+    if (instruction & (1 << 22)) {
+        // SWPB
+        value = gba.memory.read8(address);
+        gba.memory.write8(address, source & 0xFF);
+    } else {
+        value = read_word_rotated(gba.memory, address);
+        gba.memory.write32(address, source);
+    }
+
+    cpu.registers[rd] = value;
+    cpu.cycles += 3;
+}
+
+void ARM7CPU::arm_branch_exchange(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const uint32_t target = cpu.registers[instruction & 0xF];
+
+    cpu.thumb_mode = (target & 1) != 0;
+    if (cpu.thumb_mode) {
+        cpu.cpsr |= FLAG_T;
+    } else {
+        cpu.cpsr &= ~FLAG_T;
+    }
+
+    cpu.branch_to(target);
+}
+
+void ARM7CPU::arm_halfword_transfer(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const bool pre_index = (instruction & (1 << 24)) != 0;
+    const bool up = (instruction & (1 << 23)) != 0;
+    const bool writeback = (instruction & (1 << 21)) != 0;
+    const bool load = (instruction & (1 << 20)) != 0;
+    const uint32_t rn = (instruction >> 16) & 0xF;
+    const uint32_t rd = (instruction >> 12) & 0xF;
+    const uint32_t type = (instruction >> 5) & 3;
+
+    uint32_t offset;
+    if (instruction & (1 << 22)) {
+        offset = ((instruction >> 4) & 0xF0) | (instruction & 0xF);
+    } else {
+        offset = cpu.registers[instruction & 0xF];
+    }
+
+    const uint32_t base = cpu.registers[rn];
+    const uint32_t offset_address = up ? base + offset : base - offset;
+    const uint32_t address = pre_index ? offset_address : base;
+
+    if (!load && type == 1) {
+        // STRH; the signed forms do not store on ARMv4
+        gba.memory.write16(address & ~1, cpu.registers[rd] + (rd == 15 ? 4 : 0));
+    }
+
+    // Post-indexed transfers always write back
+    if ((!pre_index || writeback) && rn != 15) {
+        cpu.registers[rn] = offset_address;
+    }
+
+    if (!load) {
+        cpu.cycles++;
+        return;
+    }
+
+    uint32_t value;
+    switch (type) {
+        case 1: // LDRH: misaligned loads rotate the halfword
+            value = std::rotr(static_cast<uint32_t>(gba.memory.read16(address & ~1)), (address & 1) * 8);
+            break;
+        case 2: // LDRSB
+            value = static_cast<uint32_t>(static_cast<int8_t>(gba.memory.read8(address)));
+            break;
+        default: // LDRSH: misaligned loads behave like LDRSB
+            if (address & 1) {
+                value = static_cast<uint32_t>(static_cast<int8_t>(gba.memory.read8(address)));
+            } else {
+                value = static_cast<uint32_t>(static_cast<int16_t>(gba.memory.read16(address)));
+            }
+            break;
+    }
+
+    cpu.cycles += 2;
+    if (rd == 15) {
+        cpu.branch_to(value);
+    } else {
+        cpu.registers[rd] = value;
+    }
+}
+
+void ARM7CPU::arm_single_transfer(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const bool pre_index = (instruction & (1 << 24)) != 0;
+    const bool up = (instruction & (1 << 23)) != 0;
+    const bool byte = (instruction & (1 << 22)) != 0;
+    const bool writeback = (instruction & (1 << 21)) != 0;
+    const bool load = (instruction & (1 << 20)) != 0;
+    const uint32_t rn = (instruction >> 16) & 0xF;
+    const uint32_t rd = (instruction >> 12) & 0xF;
+
+    uint32_t offset;
+    if (instruction & (1 << 25)) {
+        // Register offset shifted by an immediate; the shifter carry-out is discarded
+        const uint32_t rm = cpu.registers[instruction & 0xF];
+        const uint32_t amount = (instruction >> 7) & 0x1F;
+        bool carry = false;
+        switch ((instruction >> 5) & 3) {
+            case 0: offset = shift_operand<0, true, false>(rm, amount, carry); break;
+            case 1: offset = shift_operand<1, true, false>(rm, amount, carry); break;
+            case 2: offset = shift_operand<2, true, false>(rm, amount, carry); break;
+            default: offset = shift_operand<3, true, false>(rm, amount, carry); break;
+        }
+    } else {
+        offset = instruction & 0xFFF;
+    }
+
+    const uint32_t base = cpu.registers[rn];
+    const uint32_t offset_address = up ? base + offset : base - offset;
+    const uint32_t address = pre_index ? offset_address : base;
+
+    if (!load) {
+        // STR of R15 stores the instruction address plus 12
+        const uint32_t value = cpu.registers[rd] + (rd == 15 ? 4 : 0);
+        if (byte) {
+            gba.memory.write8(address, value & 0xFF);
+        } else {
+            gba.memory.write32(address, value);
+        }
+    }
+
+    if ((!pre_index || writeback) && rn != 15) {
+        cpu.registers[rn] = offset_address;
+    }
+
+    if (!load) {
+        cpu.cycles++;
+        return;
+    }
+
+    // A loaded base register wins over the writeback
+    const uint32_t value = byte ? gba.memory.read8(address) : read_word_rotated(gba.memory, address);
+    cpu.cycles += 2;
+    if (rd == 15) {
+        cpu.branch_to(value);
+    } else {
+        cpu.registers[rd] = value;
+    }
+}
+
+void ARM7CPU::arm_block_transfer(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const bool pre_index = (instruction & (1 << 24)) != 0;
+    const bool up = (instruction & (1 << 23)) != 0;
+    const bool psr = (instruction & (1 << 22)) != 0;
+    const bool writeback = (instruction & (1 << 21)) != 0;
+    const bool load = (instruction & (1 << 20)) != 0;
+    const uint32_t rn = (instruction >> 16) & 0xF;
+    uint32_t register_list = instruction & 0xFFFF;
+
+    const uint32_t base = cpu.registers[rn];
+    uint32_t size = std::popcount(register_list) * 4;
+
+    // An empty list transfers R15 and moves the base by 0x40
+    if (register_list == 0) {
+        register_list = 1 << 15;
+        size = 0x40;
+    }
+
+    // Registers are always transferred lowest first, at the lowest address
+    uint32_t address = up ? base : base - size;
+    if (pre_index == up) address += 4;
+    const uint32_t final_base = up ? base + size : base - size;
+
+    // The S bit selects the User bank unless this is an LDM that loads R15 (exception return)
+    const bool user_bank = psr && !(load && (register_list & (1 << 15)));
+    const bool loads_base = load && (register_list & (1 << rn));
+
+    // A range inside EWRAM or IWRAM is accessed through the backing array directly
+    const uint32_t count = std::popcount(register_list);
+    const uint32_t* source = load ? gba.memory.ram_words(address, count) : nullptr;
+    uint32_t* destination = load ? nullptr : gba.memory.writable_ram_words(address, count);
+
+    bool first = true;
+    for (uint32_t reg = 0; reg < 16; reg++) {
+        if (!(register_list & (1 << reg))) continue;
+
+        if (load) {
+            const uint32_t value = source ? *source++ : gba.memory.read32(address);
+            if (reg == 15) {
+                if (psr) cpu.restore_cpsr();
+                cpu.branch_to(value);
+            } else if (user_bank) {
+                cpu.user_register(reg) = value;
+            } else {
+                cpu.registers[reg] = value;
+            }
+        } else {
+            uint32_t value = user_bank ? cpu.user_register(reg) : cpu.registers[reg];
+            if (reg == 15) value = cpu.registers[15] + 4;
+            if (destination) {
+                *destination++ = value;
+            } else {
+                gba.memory.write32(address, value);
+            }
+        }
+
+        // The base is written back after the first transfer, so only a leading STM base stores the old value
+        if (first && writeback && !loads_base) {
+            cpu.registers[rn] = final_base;
+        }
+        first = false;
+        address += 4;
+    }
+    if (destination && gba.memory.write_log) gba.memory.log_ram_words(address - count * 4, count);
+
+    cpu.cycles += size / 4 + (load ? 1 : 0);
+}
+
+void ARM7CPU::arm_branch(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    const int32_t offset = static_cast<int32_t>(instruction << 8) >> 6;
+
+    if (instruction & (1 << 24)) {
+        // BL
+        cpu.registers[14] = cpu.next_instruction_address();
+    }
+
+    cpu.branch_to(cpu.registers[15] + offset);
+}
+
+void ARM7CPU::arm_software_interrupt(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    // The BIOS reads the function number from bits 23-16 of the comment field
+    if (cpu.hle_bios && cpu.hle_swi(gba, (instruction >> 16) & 0xFF)) return;
+    cpu.enter_exception(CpuMode::SUPERVISOR, VECTOR_SWI, cpu.next_instruction_address());
+}
+
+void ARM7CPU::arm_undefined(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    cpu.enter_exception(CpuMode::UNDEFINED, VECTOR_UNDEFINED, cpu.next_instruction_address());
+}
+
+constinit const std::array<ARM7CPU::ArmHandler, 4096> ARM7CPU::arm_table =
+    []<size_t... Index>(std::index_sequence<Index...>) {
+        return std::array<ArmHandler, 4096>{arm_handler<arm_handler_id(Index)>()...};
+    }(std::make_index_sequence<4096>{});
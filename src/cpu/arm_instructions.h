@@ -0,0 +1,216 @@
+// cpu/arm_instructions.h
+#pragma once
+
+#include "arm7_cpu.h"
+#include "alu.h"
+#include "../system.h"
+#include <bit>
+
+// The data processing handler template and the numbering of the handlers behind arm_table, shared
+// by arm_table (arm_instructions.cpp) and the threaded interpreter, which gives each handler its
+// own label and calls it directly.
+
+// Handler numbers: the 288 data processing specializations first, ordered by opcode and S bit
+// (bits 24-20) and then by operand form (the 8 register shift forms, then immediate), followed
+// by the other instruction classes
+constexpr uint32_t ARM_OPERAND_FORMS = 9;
+constexpr uint32_t ARM_IMMEDIATE_FORM = 8;
+
+enum ArmHandlerId : uint32_t {
+    ARM_MRS = 32 * ARM_OPERAND_FORMS,
+    ARM_MSR,
+    ARM_MULTIPLY,
+    ARM_MULTIPLY_LONG,
+    ARM_SWAP,
+    ARM_BRANCH_EXCHANGE,
+    ARM_HALFWORD_TRANSFER,
+    ARM_SINGLE_TRANSFER,
+    ARM_BLOCK_TRANSFER,
+    ARM_BRANCH,
+    ARM_SOFTWARE_INTERRUPT,
+    ARM_UNDEFINED,
+    ARM_HANDLER_COUNT
+};
+
+template <uint32_t Opcode, bool SetFlags, bool Immediate, uint32_t ShiftType, bool RegisterShift>
+void ARM7CPU::arm_data_processing(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction) {
+    // AND, EOR, TST, TEQ, ORR, MOV, BIC and MVN take C from the shifter; the rest compute it
+    constexpr bool logical = (Opcode & 0x6) == 0 || (Opcode & 0xC) == 0xC;
+    constexpr bool shifter_carry = SetFlags && logical;
+    // TST, TEQ, CMP and CMN only update flags
+    constexpr bool writes_result = (Opcode & 0xC) != 0x8;
+    constexpr bool uses_rn = Opcode != 0xD && Opcode != 0xF;
+
+    const uint32_t rn = (instruction >> 16) & 0xF;
+    const uint32_t rd = (instruction >> 12) & 0xF;
+
+    bool carry = false;
+    if constexpr (shifter_carry || (!Immediate && !RegisterShift && ShiftType == 3)) {
+        // RRX reads C even when the carry-out is discarded
+        carry = cpu.flags.c();
+    }
+
+    uint32_t operand1 = 0;
+    if constexpr (uses_rn) {
+        operand1 = cpu.registers[rn];
+    }
+
+    uint32_t operand2;
+    if constexpr (Immediate) {
+        // Rotated 8-bit immediate
+        const uint32_t rotate = ((instruction >> 8) & 0xF) * 2;
+        operand2 = std::rotr(instruction & 0xFF, rotate);
+        if constexpr (shifter_carry) {
+            if (rotate) carry = operand2 >> 31;
+        }
+    } else if constexpr (RegisterShift) {
+        // Register-specified shift: the extra cycle makes R15 read 12 bytes ahead
+        const uint32_t rm = instruction & 0xF;
+        const uint32_t amount = cpu.registers[(instruction >> 8) & 0xF] & 0xFF;
+        if constexpr (uses_rn) {
+            if (rn == 15) operand1 += 4;
+        }
+        operand2 = shift_operand<ShiftType, false, shifter_carry>(cpu.registers[rm] + (rm == 15 ? 4 : 0),
+                                                                   amount, carry);
+        cpu.cycles++;
+    } else {
+        operand2 = shift_operand<ShiftType, true, shifter_carry>(cpu.registers[instruction & 0xF],
+                                                                  (instruction >> 7) & 0x1F, carry);
+    }
+
+    uint32_t result;
+
+    if constexpr (Opcode == 0x0 || Opcode == 0x8) {
+        // AND, TST
+        result = operand1 & operand2;
+    } else if constexpr (Opcode == 0x1 || Opcode == 0x9) {
+        // EOR, TEQ
+        result = operand1 ^ operand2;
+    } else if constexpr (Opcode == 0x2 || Opcode == 0xA) {
+        // SUB, CMP
+        if constexpr (SetFlags) {
+            result = cpu.flags.add(operand1, ~operand2, true);
+        } else {
+            result = operand1 - operand2;
+        }
+    } else if constexpr (Opcode == 0x3) {
+        // RSB
+        if constexpr (SetFlags) {
+            result = cpu.flags.add(operand2, ~operand1, true);
+        } else {
+            result = operand2 - operand1;
+        }
+    } else if constexpr (Opcode == 0x4 || Opcode == 0xB) {
+        // ADD, CMN
+        if constexpr (SetFlags) {
+            result = cpu.flags.add(operand1, operand2, false);
+        } else {
+            result = operand1 + operand2;
+        }
+    } else if constexpr (Opcode == 0x5 || Opcode == 0x6 || Opcode == 0x7) {
+        // ADC, SBC, RSC
+        const bool carry_in = cpu.flags.c();
+        const uint32_t a = Opcode == 0x7 ? operand2 : operand1;
+        const uint32_t b = Opcode == 0x5 ? operand2 : Opcode == 0x6 ? ~operand2 : ~operand1;
+        if constexpr (SetFlags) {
+            result = cpu.flags.add(a, b, carry_in);
+        } else {
+            result = a + b + carry_in;
+        }
+    } else if constexpr (Opcode == 0xC) {
+        // ORR
+        result = operand1 | operand2;
+    } else if constexpr (Opcode == 0xD) {
+        // MOV
+        result = operand2;
+    } else if constexpr (Opcode == 0xE) {
+        // BIC
+        result = operand1 & ~operand2;
+    } else {
+        // MVN
+        result = ~operand2;
+    }
+
+    if constexpr (SetFlags) {
+        if constexpr (logical) {
+            cpu.flags.set_logic(result, carry);
+        }
+        if (rd == 15) {
+            // Exception return: CPSR comes back from SPSR instead of the ALU flags
+            cpu.restore_cpsr();
+        }
+    }
+
+    if constexpr (writes_result) {
+        if (rd == 15) {
+            cpu.branch_to(result);
+        } else {
+            cpu.registers[rd] = result;
+        }
+    }
+}
+
+constexpr uint32_t ARM7CPU::arm_handler_id(uint32_t index) {
+    // Index = bits 27-20 of the instruction in the high byte, bits 7-4 in the low nibble
+    const uint32_t high = index >> 4;
+    const uint32_t low = index & 0xF;
+
+    // Data processing handlers are specialized on opcode, S bit, operand form and shift type
+    const bool immediate = (high & 0x20) != 0;
+    const uint32_t data_processing = (high & 0x1F) * ARM_OPERAND_FORMS + (immediate ? ARM_IMMEDIATE_FORM : low & 7);
+
+    switch (high >> 5) {
+        case 0:
+            if (low == 0x9) {
+                if ((high & 0xFC) == 0x00) return ARM_MULTIPLY;
+                if ((high & 0xF8) == 0x08) return ARM_MULTIPLY_LONG;
+                if ((high & 0xFB) == 0x10) return ARM_SWAP;
+                return ARM_UNDEFINED;
+            }
+            if ((low & 0x9) == 0x9) return ARM_HALFWORD_TRANSFER;
+            if ((high & 0x19) == 0x10) {
+                // TST/TEQ/CMP/CMN without S are the PSR transfers and BX
+                if (high == 0x12 && low == 0x1) return ARM_BRANCH_EXCHANGE;
+                if ((high & 0x1B) == 0x10 && low == 0x0) return ARM_MRS;
+                if ((high & 0x1B) == 0x12 && low == 0x0) return ARM_MSR;
+                return ARM_UNDEFINED;
+            }
+            return data_processing;
+        case 1:
+            if ((high & 0x19) == 0x10) return (high & 0x1B) == 0x12 ? ARM_MSR : ARM_UNDEFINED;
+            return data_processing;
+        case 2:
+            return ARM_SINGLE_TRANSFER;
+        case 3:
+            return (low & 1) ? ARM_UNDEFINED : ARM_SINGLE_TRANSFER;
+        case 4:
+            return ARM_BLOCK_TRANSFER;
+        case 5:
+            return ARM_BRANCH;
+        case 6:
+            // Coprocessor data transfers: the GBA has no coprocessors
+            return ARM_UNDEFINED;
+        default:
+            return (high & 0x10) ? ARM_SOFTWARE_INTERRUPT : ARM_UNDEFINED;
+    }
+}
+
+template <uint32_t Id>
+constexpr ARM7CPU::ArmHandler ARM7CPU::arm_handler() {
+    static_assert(Id < ARM_HANDLER_COUNT);
+    if constexpr (Id < ARM_MRS) {
+        constexpr uint32_t opcode_s = Id / ARM_OPERAND_FORMS;
+        constexpr uint32_t form = Id % ARM_OPERAND_FORMS;
+        constexpr bool immediate = form == ARM_IMMEDIATE_FORM;
+        return &arm_data_processing<(opcode_s >> 1), (opcode_s & 1) != 0, immediate, (immediate ? 0 : form >> 1),
+                                    !immediate && (form & 1) != 0>;
+    } else {
+        constexpr ArmHandler handlers[] = {
+            &arm_mrs, &arm_msr, &arm_multiply, &arm_multiply_long, &arm_swap, &arm_branch_exchange,
+            &arm_halfword_transfer, &arm_single_transfer, &arm_block_transfer, &arm_branch,
+            &arm_software_interrupt, &arm_undefined
+        };
+        static_assert(std::size(handlers) == ARM_HANDLER_COUNT - ARM_MRS);
+        return handlers[Id - ARM_MRS];
+    }
+}
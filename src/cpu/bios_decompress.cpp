@@ -0,0 +1,260 @@
+// cpu/bios_decompress.cpp
+#include "bios_decompress.h"
+#include "../memory/memory.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DECOMPRESS_SSE2
+#endif
+
+// BIOS function numbers (the SWI comment field)
+constexpr uint32_t SWI_LZ77_WRAM = 0x11;
+constexpr uint32_t SWI_LZ77_VRAM = 0x12;
+constexpr uint32_t SWI_HUFFMAN = 0x13;
+constexpr uint32_t SWI_RL_WRAM = 0x14;
+constexpr uint32_t SWI_RL_VRAM = 0x15;
+constexpr uint32_t SWI_DIFF8_WRAM = 0x16;
+constexpr uint32_t SWI_DIFF8_VRAM = 0x17;
+constexpr uint32_t SWI_DIFF16 = 0x18;
+
+// Approximate BIOS timings: setup and header parsing, then each byte produced
+constexpr int DECOMPRESS_CYCLES = 40;
+constexpr int LZ77_CYCLES_PER_BYTE = 12;
+constexpr int HUFFMAN_CYCLES_PER_BYTE = 40;
+constexpr int RL_CYCLES_PER_BYTE = 8;
+constexpr int DIFF_CYCLES_PER_BYTE = 6;
+
+namespace {
+
+// Reads the compressed stream, straight from the backing array when the source lies in BIOS,
+// EWRAM, IWRAM or ROM and through read8 elsewhere
+class SourceReader {
+public:
+    SourceReader(const GBAMemory& memory, uint32_t address) : memory(memory) {
+        base = memory.code_region(address, start, size);
+    }
+
+    uint8_t byte(uint32_t address) const {
+        if (address - start < size) return base[address - start];
+        return memory.read8(address);
+    }
+
+    uint32_t word(uint32_t address) const {
+        return byte(address) | (byte(address + 1) << 8) | (byte(address + 2) << 16) | (static_cast<uint32_t>(byte(address + 3)) << 24);
+    }
+
+private:
+    const GBAMemory& memory;
+    const uint8_t* base;
+    uint32_t start;
+    uint32_t size;
+};
+
+// LZ77: a flag byte per eight blocks, MSB first; a clear flag is a literal byte, a set one a
+// 12-bit displacement and a 3-18 byte copy from the output already written
+void lz77(const GBAMemory& memory, const SourceReader& reader, uint32_t source, uint32_t destination,
+          std::vector<uint8_t>& output) {
+    const uint32_t size = static_cast<uint32_t>(output.size());
+    uint32_t written = 0;
+    while (written < size) {
+        const uint8_t flags = reader.byte(source++);
+        for (int block = 7; block >= 0 && written < size; block--) {
+            if (!(flags & (1 << block))) {
+                output[written++] = reader.byte(source++);
+                continue;
+            }
+
+            const uint8_t high = reader.byte(source++);
+            const uint8_t low = reader.byte(source++);
+            const uint32_t length = std::min<uint32_t>((high >> 4) + 3, size - written);
+            const uint32_t displacement = (((high & 0xF) << 8) | low) + 1;
+            if (displacement > written) {
+                // Reaches back before the output; the BIOS reads whatever the destination held
+                for (uint32_t i = 0; i < length; i++, written++) {
+                    output[written] = written >= displacement ? output[written - displacement]
+                                                              : memory.read8(destination + written - displacement);
+                }
+            } else if (displacement >= length) {
+                std::memcpy(&output[written], &output[written - displacement], length);
+                written += length;
+            } else {
+                // Overlapping copy repeats the last displacement bytes
+                for (uint32_t i = 0; i < length; i++, written++) output[written] = output[written - displacement];
+            }
+        }
+    }
+}
+
+// Huffman: a tree of 6-bit child offsets after the header, walked one bit at a time from a
+// stream of 32-bit words read MSB first. Each leaf holds a 4- or 8-bit value, packed LSB first.
+void huffman(const SourceReader& reader, uint32_t source, uint32_t data_bits, std::vector<uint8_t>& output) {
+    const uint32_t tree = source + 5;
+    uint32_t stream = source + 4 + (reader.byte(source + 4) + 1) * 2;
+    const uint32_t value_mask = (1u << data_bits) - 1;
+
+    // A tree of at most 256 nodes has no code longer than 512 bits, so a stream running past
+    // that for every value is malformed (the BIOS would walk on through memory)
+    const uint64_t values = static_cast<uint64_t>(output.size()) * 8 / data_bits;
+    const uint64_t stream_limit = values * 64 + 4;
+    uint64_t stream_read = 0;
+
+    uint32_t written = 0;
+    uint32_t packed = 0;
+    uint32_t packed_bits = 0;
+    uint32_t node_address = tree;
+    uint8_t node = reader.byte(tree);
+    while (written < output.size() && stream_read < stream_limit) {
+        uint32_t bits = reader.word(stream);
+        stream += 4;
+        stream_read += 4;
+        for (int bit = 0; bit < 32 && written < output.size(); bit++, bits <<= 1) {
+            const uint32_t children = (node_address & ~1u) + (node & 0x3F) * 2 + 2;
+            const bool right = (bits & 0x80000000) != 0;
+            const uint32_t child = children + (right ? 1 : 0);
+            if (!(node & (right ? 0x40 : 0x80))) {
+                node_address = child;
+                node = reader.byte(child);
+                continue;
+            }
+
+            packed |= (reader.byte(child) & value_mask) << packed_bits;
+            packed_bits += data_bits;
+            node_address = tree;
+            node = reader.byte(tree);
+            if (packed_bits == 32) {
+                std::memcpy(&output[written], &packed, 4);
+                written += 4;
+                packed = 0;
+                packed_bits = 0;
+            }
+        }
+    }
+}
+
+// Run-length: a flag byte, then 3-130 copies of one byte (bit 7 set) or 1-128 literal bytes
+void run_length(const SourceReader& reader, uint32_t source, std::vector<uint8_t>& output) {
+    const uint32_t size = static_cast<uint32_t>(output.size());
+    uint32_t written = 0;
+    while (written < size) {
+        const uint8_t flag = reader.byte(source++);
+        if (flag & 0x80) {
+            // memset is already vectorised by the C library
+            const uint32_t length = std::min<uint32_t>((flag & 0x7F) + 3, size - written);
+            std::memset(&output[written], reader.byte(source++), length);
+            written += length;
+        } else {
+            const uint32_t length = std::min<uint32_t>((flag & 0x7F) + 1, size - written);
+            for (uint32_t i = 0; i < length; i++) output[written++] = reader.byte(source++);
+        }
+    }
+}
+
+// Diff unfilters: each unit after the first is stored as the difference from the one before, so
+// the output is the running sum of the stream. The SSE2 paths sum 16 bytes or 8 halfwords at a
+// time in log2 shifted adds and carry the last total into the next vector.
+void unfilter8(uint8_t* data, size_t count) {
+    size_t i = 0;
+    uint8_t total = 0;
+#ifdef DECOMPRESS_SSE2
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i sum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 1));
+        sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 2));
+        sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 4));
+        sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 8));
+        sum = _mm_add_epi8(sum, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), sum);
+        total = data[i + 15];
+        carry = _mm_set1_epi8(static_cast<char>(total));
+    }
+#endif
+    for (; i < count; i++) {
+        total = static_cast<uint8_t>(total + data[i]);
+        data[i] = total;
+    }
+}
+
+void unfilter16(uint8_t* data, size_t count) {
+    size_t i = 0;
+    uint16_t total = 0;
+#ifdef DECOMPRESS_SSE2
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i sum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 2));
+        sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 2));
+        sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 4));
+        sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 8));
+        sum = _mm_add_epi16(sum, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i * 2), sum);
+        std::memcpy(&total, data + i * 2 + 14, 2);
+        carry = _mm_set1_epi16(static_cast<short>(total));
+    }
+#endif
+    for (; i < count; i++) {
+        uint16_t delta;
+        std::memcpy(&delta, data + i * 2, 2);
+        total = static_cast<uint16_t>(total + delta);
+        std::memcpy(data + i * 2, &total, 2);
+    }
+}
+
+}  // namespace
+
+bool hle_decompress(GBAMemory& memory, uint32_t function, uint32_t source, uint32_t destination, int& cycles) {
+    if (function < SWI_LZ77_WRAM || function > SWI_DIFF16) return false;
+
+    cycles = DECOMPRESS_CYCLES;
+    // The BIOS refuses to read its own image
+    if (source < EWRAM_START) return true;
+
+    const SourceReader reader(memory, source);
+    const uint32_t header = reader.word(source);
+    std::vector<uint8_t> output(header >> 8);
+
+    // Width of the BIOS routine's stores; the VRAM variants collect bytes into halfwords
+    uint32_t unit = 1;
+    switch (function) {
+        case SWI_LZ77_WRAM:
+        case SWI_LZ77_VRAM:
+            lz77(memory, reader, source + 4, destination, output);
+            unit = function == SWI_LZ77_VRAM ? 2 : 1;
+            cycles += LZ77_CYCLES_PER_BYTE * static_cast<int>(output.size());
+            break;
+        case SWI_HUFFMAN: {
+            // Only sizes that pack evenly into words are decoded
+            const uint32_t data_bits = header & 0xF;
+            if (data_bits != 4 && data_bits != 8) return true;
+            output.resize(output.size() & ~3u);
+            huffman(reader, source, data_bits, output);
+            unit = 4;
+            cycles += HUFFMAN_CYCLES_PER_BYTE * static_cast<int>(output.size());
+            break;
+        }
+        case SWI_RL_WRAM:
+        case SWI_RL_VRAM:
+            run_length(reader, source + 4, output);
+            unit = function == SWI_RL_VRAM ? 2 : 1;
+            cycles += RL_CYCLES_PER_BYTE * static_cast<int>(output.size());
+            break;
+        default: {
+            const bool wide = function == SWI_DIFF16;
+            if (wide) output.resize(output.size() & ~1u);
+            for (uint32_t i = 0; i < output.size(); i++) output[i] = reader.byte(source + 4 + i);
+            if (wide) {
+                unfilter16(output.data(), output.size() / 2);
+            } else {
+                unfilter8(output.data(), output.size());
+            }
+            unit = function == SWI_DIFF8_WRAM ? 1 : 2;
+            cycles += DIFF_CYCLES_PER_BYTE * static_cast<int>(output.size());
+            break;
+        }
+    }
+
+    memory.store_block(destination, output.data(), static_cast<uint32_t>(output.size()), unit);
+    return true;
+}
@@ -0,0 +1,12 @@
+// cpu/bios_decompress.h
+#pragma once
+
+#include <cstdint>
+
+class GBAMemory;
+
+// Native versions of the BIOS decompression calls, SWI 0x11-0x18: LZ77, Huffman, run-length and
+// the 8/16-bit diff unfilters. The stream at source is decoded on the host, then stored at
+// destination with the width of the BIOS routine's own stores, so the VRAM variants write whole
+// halfwords. False for other functions; otherwise cycles is set to an estimate of the BIOS time.
+bool hle_decompress(GBAMemory& memory, uint32_t function, uint32_t source, uint32_t destination, int& cycles);
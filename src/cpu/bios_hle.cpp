@@ -0,0 +1,341 @@
+// cpu/bios_hle.cpp
+#include "arm7_cpu.h"
+#include "../system.h"
+#include "alu.h"
+#include "bios_decompress.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+// Word in which the game's IRQ handler reports serviced interrupts to IntrWait
+constexpr uint32_t BIOS_IRQ_FLAGS = 0x03007FF8;
+
+// BIOS function numbers (the SWI comment field)
+constexpr uint32_t SWI_INTR_WAIT = 0x04;
+constexpr uint32_t SWI_VBLANK_INTR_WAIT = 0x05;
+constexpr uint32_t SWI_DIV = 0x06;
+constexpr uint32_t SWI_DIV_ARM = 0x07;
+constexpr uint32_t SWI_SQRT = 0x08;
+constexpr uint32_t SWI_ARC_TAN = 0x09;
+constexpr uint32_t SWI_ARC_TAN2 = 0x0A;
+
+// Approximate BIOS timings: the SWI entry, dispatch and return around every call, and what the
+// math routines spend on top of that
+constexpr int SWI_CALL_CYCLES = 20;
+constexpr int DIV_CYCLES = 11;
+constexpr int DIV_CYCLES_PER_BIT = 13;
+constexpr int SQRT_CYCLES = 16;
+constexpr int SQRT_CYCLES_PER_BIT = 12;
+constexpr int ARC_TAN_CYCLES = 37;
+constexpr int ARC_TAN2_EARLY_CYCLES = 11;
+constexpr int ARC_TAN2_CYCLES = 30;
+
+// The BIOS IRQ dispatcher, for running without a BIOS image. It calls the game's handler from
+// 0x03007FFC with R0 = 0x04000000, as the real one does; the handler's own IRQ return is not
+// BIOS code being emulated, just the exception entry and exit every game relies on.
+//   0x18  stmfd sp!, {r0-r3, r12, lr}
+//   0x1C  mov r0, #0x04000000
+//   0x20  ldr r12, [pc, #12]
+//   0x24  add lr, pc, #0
+//   0x28  ldr pc, [r12]
+//   0x2C  ldmfd sp!, {r0-r3, r12, lr}
+//   0x30  subs pc, lr, #4
+//   0x34  .word 0x03007FFC
+constexpr std::array<uint32_t, 8> IRQ_DISPATCHER = {
+    0xE92D500F, 0xE3A00301, 0xE59FC00C, 0xE28FE000, 0xE59CF000, 0xE8BD500F, 0xE25EF004, 0x03007FFC
+};
+
+namespace {
+
+struct DivResult {
+    uint32_t quotient;
+    uint32_t remainder;
+    uint32_t abs_quotient;
+    int cycles;
+};
+
+// Div: truncating signed division. The BIOS loops forever dividing anything but 0 and +-1 by zero,
+// and for a very long time on INT_MIN / -1; those give the results other BIOS HLEs settled on.
+DivResult bios_div(int32_t numerator, int32_t denominator) {
+    DivResult result;
+    if (denominator == 0) {
+        result = {numerator < 0 ? 0xFFFFFFFFu : 1u, static_cast<uint32_t>(numerator), 1, 0};
+    } else if (denominator == -1 && numerator == INT32_MIN) {
+        result = {0x80000000u, 0, 0x80000000u, 0};
+    } else {
+        const int32_t quotient = numerator / denominator;
+        result.quotient = static_cast<uint32_t>(quotient);
+        result.remainder = static_cast<uint32_t>(numerator % denominator);
+        result.abs_quotient = quotient < 0 ? 0u - result.quotient : result.quotient;
+    }
+
+    // One pass of the shift-and-subtract loop per quotient bit
+    const uint32_t magnitude_n = numerator < 0 ? 0u - static_cast<uint32_t>(numerator) : numerator;
+    const uint32_t magnitude_d = denominator < 0 ? 0u - static_cast<uint32_t>(denominator) : denominator;
+    const int bits = std::countl_zero(magnitude_d) - std::countl_zero(magnitude_n);
+    result.cycles = DIV_CYCLES + DIV_CYCLES_PER_BIT * std::max(bits, 1);
+    return result;
+}
+
+// Sqrt: floor of the square root. Every uint32_t is exact in a double and the root is correctly
+// rounded, so truncating it never lands on the wrong side of an integer.
+uint32_t bios_sqrt(uint32_t value, int& cycles) {
+    cycles = SQRT_CYCLES + SQRT_CYCLES_PER_BIT * ((std::bit_width(value) + 1) / 2);
+    return static_cast<uint32_t>(std::sqrt(static_cast<double>(value)));
+}
+
+// The BIOS multiplies in 32 bits and shifts arithmetically, wrapping on large inputs
+int32_t mul_asr(int32_t a, int32_t b, int shift) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b)) >> shift;
+}
+
+// ArcTan: the BIOS polynomial in 1.14 fixed point, term for term. R1 and R3 are left holding
+// the squared input and the polynomial, as the BIOS leaves them.
+int32_t bios_arc_tan(int32_t tangent, uint32_t& r1, uint32_t& r3, int& cycles) {
+    static constexpr std::array<int32_t, 6> COEFFICIENTS = {0x91C, 0xFB6, 0x16AA, 0x2081, 0x3651, 0xA2F9};
+    cycles = ARC_TAN_CYCLES + multiply_cycles(static_cast<uint32_t>(tangent));
+
+    const int32_t square = -mul_asr(tangent, tangent, 14);
+    cycles += multiply_cycles(static_cast<uint32_t>(square));
+    int32_t polynomial = mul_asr(0xA9, square, 14) + 0x390;
+    for (int32_t coefficient : COEFFICIENTS) {
+        cycles += multiply_cycles(static_cast<uint32_t>(square));
+        polynomial = mul_asr(polynomial, square, 14) + coefficient;
+    }
+
+    r1 = static_cast<uint32_t>(square);
+    r3 = static_cast<uint32_t>(polynomial);
+    return mul_asr(tangent, polynomial, 16);
+}
+
+// ArcTan2: the angle of (x, y) in 0..0xFFFF. The BIOS folds it into the octant around the
+// nearer axis and takes ArcTan of y/x or x/y there, with 14 fraction bits.
+uint32_t bios_arc_tan2(int32_t x, int32_t y, uint32_t& r1, int& cycles) {
+    if (y == 0) {
+        cycles = ARC_TAN2_EARLY_CYCLES;
+        return x >= 0 ? 0 : 0x8000;
+    }
+    if (x == 0) {
+        cycles = ARC_TAN2_EARLY_CYCLES;
+        return y >= 0 ? 0x4000 : 0xC000;
+    }
+
+    uint32_t r3;
+    auto arc_tan = [&](int32_t numerator, int32_t denominator) {
+        const DivResult ratio = bios_div(static_cast<int32_t>(static_cast<uint32_t>(numerator) << 14), denominator);
+        int arc_tan_cycles;
+        const int32_t angle = bios_arc_tan(static_cast<int32_t>(ratio.quotient), r1, r3, arc_tan_cycles);
+        cycles = ARC_TAN2_CYCLES + ratio.cycles + arc_tan_cycles;
+        return static_cast<uint32_t>(angle);
+    };
+
+    uint32_t angle;
+    if (y >= 0) {
+        if (x >= 0 && x >= y) {
+            angle = arc_tan(y, x);
+        } else if (x < 0 && -x >= y) {
+            angle = arc_tan(y, x) + 0x8000;
+        } else {
+            angle = 0x4000 - arc_tan(x, y);
+        }
+    } else {
+        if (x <= 0 && -x > -y) {
+            angle = arc_tan(y, x) + 0x8000;
+        } else if (x > 0 && x >= -y) {
+            angle = arc_tan(y, x) + 0x10000;
+        } else {
+            angle = 0xC000 - arc_tan(x, y);
+        }
+    }
+    return angle & 0xFFFF;
+}
+
+// One math call: the function, R0 and R1 going in, and R0, R1 and R3 coming out. R3 is set to
+// SELFTEST_R3 beforehand, so calls that leave it alone expect that.
+struct MathVector {
+    uint32_t function;
+    uint32_t r0;
+    uint32_t r1;
+    uint32_t out_r0;
+    uint32_t out_r1;
+    uint32_t out_r3;
+};
+
+constexpr uint32_t SELFTEST_R3 = 0xDEADBEEF;
+
+// Signs and rounding, division by zero, INT_MIN / -1 and DivArm's swapped operands; Sqrt around
+// perfect squares; ArcTan at 0, +-1.0 and inputs that wrap the 32-bit products; ArcTan2 on the
+// axes and on either side of every octant boundary
+constexpr MathVector MATH_VECTORS[] = {
+    {SWI_DIV, 0x00000007, 0x00000002, 0x00000003, 0x00000001, 0x00000003},
+    {SWI_DIV, 0x00000007, 0xFFFFFFFE, 0xFFFFFFFD, 0x00000001, 0x00000003},
+    {SWI_DIV, 0xFFFFFFF9, 0x00000002, 0xFFFFFFFD, 0xFFFFFFFF, 0x00000003},
+    {SWI_DIV, 0xFFFFFFF9, 0xFFFFFFFE, 0x00000003, 0xFFFFFFFF, 0x00000003},
+    {SWI_DIV, 0x00000000, 0x00000005, 0x00000000, 0x00000000, 0x00000000},
+    {SWI_DIV, 0x00000005, 0x00000000, 0x00000001, 0x00000005, 0x00000001},
+    {SWI_DIV, 0xFFFFFFFB, 0x00000000, 0xFFFFFFFF, 0xFFFFFFFB, 0x00000001},
+    {SWI_DIV, 0x00000000, 0x00000000, 0x00000001, 0x00000000, 0x00000001},
+    {SWI_DIV, 0x80000000, 0xFFFFFFFF, 0x80000000, 0x00000000, 0x80000000},
+    {SWI_DIV, 0x80000000, 0x00000001, 0x80000000, 0x00000000, 0x80000000},
+    {SWI_DIV, 0x7FFFFFFF, 0xFFFFFFFF, 0x80000001, 0x00000000, 0x7FFFFFFF},
+    {SWI_DIV_ARM, 0x00000002, 0x00000007, 0x00000003, 0x00000001, 0x00000003},
+    {SWI_DIV_ARM, 0x00000000, 0x00000005, 0x00000001, 0x00000005, 0x00000001},
+    {SWI_SQRT, 0x00000000, 0x00001234, 0x00000000, 0x00001234, 0xDEADBEEF},
+    {SWI_SQRT, 0x00000001, 0x00001234, 0x00000001, 0x00001234, 0xDEADBEEF},
+    {SWI_SQRT, 0x0000000F, 0x00001234, 0x00000003, 0x00001234, 0xDEADBEEF},
+    {SWI_SQRT, 0x00000010, 0x00001234, 0x00000004, 0x00001234, 0xDEADBEEF},
+    {SWI_SQRT, 0xFFFE0000, 0x00001234, 0x0000FFFE, 0x00001234, 0xDEADBEEF},
+    {SWI_SQRT, 0xFFFE0001, 0x00001234, 0x0000FFFF, 0x00001234, 0xDEADBEEF},
+    {SWI_SQRT, 0xFFFFFFFF, 0x00001234, 0x0000FFFF, 0x00001234, 0xDEADBEEF},
+    {SWI_ARC_TAN, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x0000A2F9},
+    {SWI_ARC_TAN, 0x00004000, 0x00000000, 0x00002000, 0xFFFFC000, 0x00008000},
+    {SWI_ARC_TAN, 0xFFFFC000, 0x00000000, 0xFFFFE000, 0xFFFFC000, 0x00008000},
+    {SWI_ARC_TAN, 0x00002000, 0x00000000, 0x000012E4, 0xFFFFF000, 0x00009720},
+    {SWI_ARC_TAN, 0x00012345, 0x00000000, 0xFFFFE8FB, 0xFFFED269, 0x0001ADC6},
+    {SWI_ARC_TAN, 0x7FFFFFFF, 0x00000000, 0x00007FFF, 0x00000000, 0x0000A2F9},
+    {SWI_ARC_TAN, 0x80000000, 0x00000000, 0xFFFF8000, 0x00000000, 0x0000A2F9},
+    {SWI_ARC_TAN2, 0x00000001, 0x00000000, 0x00000000, 0x00000000, 0x00000170},
+    {SWI_ARC_TAN2, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000170},
+    {SWI_ARC_TAN2, 0xFFFFFFFF, 0x00000000, 0x00008000, 0x00000000, 0x00000170},
+    {SWI_ARC_TAN2, 0x00000000, 0x00000001, 0x00004000, 0x00000001, 0x00000170},
+    {SWI_ARC_TAN2, 0x00000000, 0xFFFFFFFF, 0x0000C000, 0xFFFFFFFF, 0x00000170},
+    {SWI_ARC_TAN2, 0x00000100, 0x00000100, 0x00002000, 0xFFFFC000, 0x00000170},
+    {SWI_ARC_TAN2, 0x00000100, 0x000000FF, 0x00001FEB, 0xFFFFC080, 0x00000170},
+    {SWI_ARC_TAN2, 0x000000FF, 0x00000100, 0x00002015, 0xFFFFC080, 0x00000170},
+    {SWI_ARC_TAN2, 0xFFFFFF00, 0x00000100, 0x00006000, 0xFFFFC000, 0x00000170},
+    {SWI_ARC_TAN2, 0xFFFFFF00, 0x000000FF, 0x00006014, 0xFFFFC080, 0x00000170},
+    {SWI_ARC_TAN2, 0xFFFFFF00, 0xFFFFFF00, 0x0000A000, 0xFFFFC000, 0x00000170},
+    {SWI_ARC_TAN2, 0xFFFFFF00, 0xFFFFFF01, 0x00009FEB, 0xFFFFC080, 0x00000170},
+    {SWI_ARC_TAN2, 0x00000100, 0xFFFFFF00, 0x0000E000, 0xFFFFC000, 0x00000170},
+    {SWI_ARC_TAN2, 0x00000100, 0xFFFFFF01, 0x0000E014, 0xFFFFC080, 0x00000170},
+    {SWI_ARC_TAN2, 0x00004000, 0x00000001, 0x00000000, 0x00000000, 0x00000170},
+    {SWI_ARC_TAN2, 0x00004000, 0xFFFFFFFF, 0x0000FFFF, 0x00000000, 0x00000170},
+};
+
+}  // namespace
+
+bool ARM7CPU::hle_math_selftest() {
+    // The math calls only touch the CPU registers, but hle_swi() takes the whole system
+    auto gba = std::make_unique<GBASystem>();
+    ARM7CPU& cpu = gba->cpu;
+
+    bool passed = true;
+    for (const MathVector& vector : MATH_VECTORS) {
+        cpu.registers[0] = vector.r0;
+        cpu.registers[1] = vector.r1;
+        cpu.registers[3] = SELFTEST_R3;
+        cpu.hle_swi(*gba, vector.function);
+
+        if (cpu.registers[0] != vector.out_r0 || cpu.registers[1] != vector.out_r1 || cpu.registers[3] != vector.out_r3) {
+            passed = false;
+            std::cout << std::hex << "SWI 0x" << vector.function << " (0x" << vector.r0 << ", 0x" << vector.r1
+                      << "): got 0x" << cpu.registers[0] << ", 0x" << cpu.registers[1] << ", 0x" << cpu.registers[3]
+                      << "; expected 0x" << vector.out_r0 << ", 0x" << vector.out_r1 << ", 0x" << vector.out_r3
+                      << std::dec << std::endl;
+        }
+    }
+    return passed;
+}
+
+void ARM7CPU::install_hle_bios(GBASystem& gba) {
+    // A loaded BIOS image keeps its own dispatcher
+    for (uint8_t byte : gba.memory.bios) {
+        if (byte != 0) return;
+    }
+    std::memcpy(&gba.memory.bios[VECTOR_IRQ], IRQ_DISPATCHER.data(), sizeof(IRQ_DISPATCHER));
+}
+
+bool ARM7CPU::hle_swi(GBASystem& gba, uint32_t function) {
+    #ifdef DEBUG_BIOS
+    std::cout << "BIOS call 0x" << std::hex << function << std::dec << std::endl;
+    #endif
+
+    switch (function) {
+        case SWI_INTR_WAIT:
+            hle_intr_wait(gba, registers[0] != 0, static_cast<uint16_t>(registers[1]));
+            return true;
+        case SWI_VBLANK_INTR_WAIT:
+            registers[0] = 1;
+            registers[1] = 1;
+            hle_intr_wait(gba, true, 1 << IRQ_VBLANK);
+            return true;
+        case SWI_DIV:
+        case SWI_DIV_ARM: {
+            // DivArm takes its operands the other way round, for code ported from ARM's library
+            const uint32_t numerator = registers[function == SWI_DIV ? 0 : 1];
+            const uint32_t denominator = registers[function == SWI_DIV ? 1 : 0];
+            const DivResult result = bios_div(static_cast<int32_t>(numerator), static_cast<int32_t>(denominator));
+            registers[0] = result.quotient;
+            registers[1] = result.remainder;
+            registers[3] = result.abs_quotient;
+            cycles += SWI_CALL_CYCLES + result.cycles;
+            return true;
+        }
+        case SWI_SQRT: {
+            int sqrt_cycles;
+            registers[0] = bios_sqrt(registers[0], sqrt_cycles);
+            cycles += SWI_CALL_CYCLES + sqrt_cycles;
+            return true;
+        }
+        case SWI_ARC_TAN: {
+            int arc_tan_cycles;
+            uint32_t r1, r3;
+            registers[0] = static_cast<uint32_t>(bios_arc_tan(static_cast<int32_t>(registers[0]), r1, r3, arc_tan_cycles));
+            registers[1] = r1;
+            registers[3] = r3;
+            cycles += SWI_CALL_CYCLES + arc_tan_cycles;
+            return true;
+        }
+        case SWI_ARC_TAN2: {
+            int arc_tan2_cycles;
+            uint32_t r1 = registers[1];
+            registers[0] = bios_arc_tan2(static_cast<int32_t>(registers[0]), static_cast<int32_t>(registers[1]), r1, arc_tan2_cycles);
+            registers[1] = r1;
+            registers[3] = 0x170;  // Left behind by the BIOS routine
+            cycles += SWI_CALL_CYCLES + arc_tan2_cycles;
+            return true;
+        }
+        default: {
+            int decompress_cycles;
+            if (!hle_decompress(gba.memory, function, registers[0], registers[1], decompress_cycles)) return false;
+            cycles += SWI_CALL_CYCLES + decompress_cycles;
+            return true;
+        }
+    }
+}
+
+void ARM7CPU::hle_intr_wait(GBASystem& gba, bool discard, uint16_t wait_flags) {
+    gba.interrupt_master = 1;
+
+    // Old flags are only discarded on the first call, not when the SWI runs again after an interrupt
+    uint16_t reported = gba.memory.read16(BIOS_IRQ_FLAGS);
+    if (discard && !intr_wait_resumed) reported &= ~wait_flags;
+    intr_wait_resumed = false;
+
+    if (reported & wait_flags) {
+        gba.memory.write16(BIOS_IRQ_FLAGS, reported & ~wait_flags);
+        return;
+    }
+    gba.memory.write16(BIOS_IRQ_FLAGS, reported);
+
+    // Sleep from the next slice on; see resume_intr_wait()
+    intr_wait_address = registers[15] - (thumb_mode ? 4 : 8);
+    power_state = PowerState::INTR_WAIT;
+    yield_requested = true;
+}
+
+bool ARM7CPU::resume_intr_wait(GBASystem& gba) {
+    // The BIOS halts until an enabled interrupt is requested, lets the game's handler run, then
+    // checks the flag word again. Going back to the SWI lets the IRQ return there for that check.
+    // If the IRQ cannot be taken nothing can set the flag, so the wait goes on.
+    if (!gba.has_pending_interrupts() || (cpsr & FLAG_I)) return false;
+
+    registers[15] = intr_wait_address;
+    flush_pipeline();
+    intr_wait_resumed = true;
+    return true;
+}
@@ -0,0 +1,15 @@
+// cpu/block_cache.cpp
+#include "block_cache.h"
+
+void BlockCache::invalidate_page(uint32_t address) {
+    auto page = page_blocks.find(address >> CODE_PAGE_SHIFT);
+    if (page == page_blocks.end()) return;
+
+    for (uint32_t block_key : page->second) {
+        auto it = blocks.find(block_key);
+        if (it != blocks.end()) {
+            retired.push_back(blocks.extract(it));
+        }
+    }
+    page_blocks.erase(page);
+}
@@ -0,0 +1,91 @@
+// cpu/block_cache.h
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "../memory/memory.h"
+
+// Forward declarations
+class ARM7CPU;
+class GBASystem;
+
+// One pre-decoded instruction: the handler the decode table picked and the raw opcode
+struct MicroOp {
+    union {
+        void (*arm)(ARM7CPU& cpu, GBASystem& gba, uint32_t instruction);
+        void (*thumb)(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction);
+    };
+    uint32_t opcode;
+    uint32_t condition;  // ARM condition field (AL for Thumb)
+};
+
+// Host code translated from a block by the JIT (jit_x64.h)
+using NativeBlock = void (*)(ARM7CPU* cpu);
+
+// A straight-line run of guest instructions ending at a branch, a PC write or a page boundary
+struct CachedBlock {
+    uint32_t start = 0;
+    bool thumb = false;
+    std::vector<MicroOp> ops;
+    NativeBlock native = nullptr;   // Set once the JIT has translated the block
+    uint32_t executions = 0;        // Times replayed by the cached interpreter (tiering)
+    bool idle_loop = false;         // Spins until memory it reads changes (idle_loop.h)
+};
+
+// Decoded blocks keyed by (PC, Thumb bit)
+class BlockCache {
+public:
+    CachedBlock* find(uint32_t pc, bool thumb) {
+        auto it = blocks.find(key(pc, thumb));
+        return it != blocks.end() ? &it->second : nullptr;
+    }
+
+    CachedBlock& insert(CachedBlock&& block) {
+        const uint32_t block_key = key(block.start, block.thumb);
+        page_blocks[block.start >> CODE_PAGE_SHIFT].push_back(block_key);
+        return blocks.insert_or_assign(block_key, std::move(block)).first->second;
+    }
+
+    // Drop every block that starts in the 1KB page holding address. Blocks never cross a page,
+    // so these are all the blocks decoded from it. The dropped blocks are kept alive until
+    // release_retired(), since the one being executed may be among them.
+    void invalidate_page(uint32_t address);
+    void release_retired() { retired.clear(); }
+
+    // Times code at pc was entered before it had a block (tiering)
+    uint32_t& entry_count(uint32_t pc, bool thumb) { return entries[key(pc, thumb)]; }
+
+    // Visit every block invalidate_page(address) would drop
+    template <typename Visitor>
+    void for_each_in_page(uint32_t address, Visitor visit) {
+        auto page = page_blocks.find(address >> CODE_PAGE_SHIFT);
+        if (page == page_blocks.end()) return;
+        for (uint32_t block_key : page->second) {
+            auto it = blocks.find(block_key);
+            if (it != blocks.end()) visit(it->second);
+        }
+    }
+
+    template <typename Visitor>
+    void for_each(Visitor visit) {
+        for (auto& entry : blocks) visit(entry.second);
+    }
+
+    void clear() {
+        blocks.clear();
+        page_blocks.clear();
+        entries.clear();
+        retired.clear();
+    }
+    uint32_t size() const { return static_cast<uint32_t>(blocks.size()); }
+
+private:
+    // Instruction addresses are at least halfword aligned, which leaves bit 0 for the state
+    static uint32_t key(uint32_t pc, bool thumb) { return pc | static_cast<uint32_t>(thumb); }
+
+    std::unordered_map<uint32_t, CachedBlock> blocks;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> page_blocks;  // Page -> block keys
+    std::vector<std::unordered_map<uint32_t, CachedBlock>::node_type> retired;
+    std::unordered_map<uint32_t, uint32_t> entries;
+};
@@ -0,0 +1,232 @@
+// cpu/cached_interpreter.cpp
+#include "arm7_cpu.h"
+#include "idle_loop.h"
+#include "../system.h"
+#include <cstring>
+
+// Instructions after which execution may not continue sequentially
+static bool ends_arm_block(uint32_t instruction) {
+    if ((instruction & 0x0E000000) == 0x0A000000) return true;  // B, BL
+    if ((instruction & 0x0FFFFFF0) == 0x012FFF10) return true;  // BX
+    if ((instruction & 0x0F000000) == 0x0F000000) return true;  // SWI
+    if ((instruction & 0x0C000000) == 0x0C000000) return true;  // Coprocessor (undefined)
+    if ((instruction & 0x0E000010) == 0x06000010) return true;  // Undefined
+    if ((instruction & 0x0E108000) == 0x08108000) return true;  // LDM with PC in the list
+    if ((instruction & 0x0C10F000) == 0x0410F000) return true;  // LDR PC
+    if ((instruction & 0x0C00F000) == 0x0000F000) return true;  // Data processing / LDRH into PC
+    return false;
+}
+
+static bool ends_thumb_block(uint16_t instruction) {
+    if ((instruction & 0xFC00) == 0x4400) {
+        // Hi register operations: BX, or anything writing R15
+        const uint32_t op = (instruction >> 8) & 3;
+        const uint32_t rd = (instruction & 7) | ((instruction >> 4) & 8);
+        return op == 3 || (op != 1 && rd == 15);
+    }
+    if ((instruction & 0xFF00) == 0xBD00) return true;  // POP {..., PC}
+    if ((instruction & 0xF000) == 0xD000) return true;  // Conditional branch, SWI
+    if ((instruction & 0xF000) == 0xE000) return true;  // B, undefined
+    if ((instruction & 0xF800) == 0xF800) return true;  // BL (second half)
+    return false;
+}
+
+CachedBlock* ARM7CPU::build_block(GBASystem& gba, uint32_t address) {
+    // Only memory that code normally runs from is cached; anything else is interpreted
+    uint32_t region_start;
+    uint32_t region_size;
+    const uint8_t* region = gba.memory.code_region(address, region_start, region_size);
+    if (!region || address - region_start >= region_size) {
+        return nullptr;
+    }
+
+    // Writes to this page must now invalidate what is decoded from it
+    gba.memory.mark_code_page(address);
+
+    CachedBlock block;
+    if (!decode_block(region, region_start, region_size, address, thumb_mode, block)) return nullptr;
+    return &block_cache.insert(std::move(block));
+}
+
+bool ARM7CPU::decode_block(const uint8_t* region, uint32_t region_start, uint32_t region_size, uint32_t address,
+                           bool thumb, CachedBlock& block) {
+    block.start = address;
+    block.thumb = thumb;
+
+    const uint32_t page_end = (address | ((1u << CODE_PAGE_SHIFT) - 1)) + 1;
+    const uint32_t region_end = region_start + region_size;
+    const uint32_t end = page_end < region_end ? page_end : region_end;
+
+    if (thumb) {
+        for (; address + 2 <= end; address += 2) {
+            uint16_t instruction;
+            std::memcpy(&instruction, region + (address - region_start), 2);
+            MicroOp op;
+            op.thumb = thumb_table[instruction >> 6];
+            op.opcode = instruction;
+            op.condition = CONDITION_ALWAYS;
+            block.ops.push_back(op);
+            if (ends_thumb_block(instruction)) break;
+        }
+    } else {
+        for (; address + 4 <= end; address += 4) {
+            uint32_t instruction;
+            std::memcpy(&instruction, region + (address - region_start), 4);
+            MicroOp op;
+            op.arm = arm_table[((instruction >> 16) & 0xFF0) | ((instruction >> 4) & 0xF)];
+            op.opcode = instruction;
+            op.condition = instruction >> 28;
+            block.ops.push_back(op);
+            if (ends_arm_block(instruction)) break;
+        }
+    }
+
+    if (block.ops.empty()) return false;
+    block.idle_loop = is_idle_loop(block);
+    return true;
+}
+
+void ARM7CPU::execute_block(GBASystem& gba, const CachedBlock& block) {
+    // Each op sees R15 as its own address plus 8 (ARM) or 4 (Thumb), as with the real pipeline
+    pipeline_flushed = false;
+    uint32_t address = block.start;
+
+    if (block.thumb) {
+        for (const MicroOp& op : block.ops) {
+            registers[15] = address + 4;
+            #ifdef DEBUG_TRACE
+            trace.record(address, op.opcode, get_cpsr(), static_cast<uint32_t>(cycles));
+            #endif
+            op.thumb(*this, gba, static_cast<uint16_t>(op.opcode));
+            cycles++;
+            if (pipeline_flushed) return;
+            address += 2;
+            if (yield_requested || code_invalidated) break;
+        }
+    } else {
+        for (const MicroOp& op : block.ops) {
+            registers[15] = address + 8;
+            #ifdef DEBUG_TRACE
+            trace.record(address, op.opcode, get_cpsr(), static_cast<uint32_t>(cycles));
+            #endif
+            if (op.condition == CONDITION_ALWAYS || check_condition(op.condition)) {
+                op.arm(*this, gba, op.opcode);
+            }
+            cycles++;
+            if (pipeline_flushed) return;
+            address += 4;
+            if (yield_requested || code_invalidated) break;
+        }
+    }
+
+    // Fell off the end, yielded or overwrote cached code: continue from the next
+    // instruction with an empty pipeline
+    registers[15] = address;
+    flush_pipeline();
+}
+
+void ARM7CPU::invalidate_code(uint32_t address) {
+    unlink_native(address);
+    block_cache.invalidate_page(address);
+    code_invalidated = true;
+}
+
+void ARM7CPU::interpret_until_branch(GBASystem& gba, uint64_t deadline) {
+    do {
+        step(gba);
+    } while (!pipeline_flushed && !yield_requested && cycles < deadline);
+
+    // Back to a block boundary with nothing prefetched
+    if (!pipeline_flushed) {
+        registers[15] -= thumb_mode ? 4 : 8;
+        flush_pipeline();
+    }
+}
+
+int ARM7CPU::run_cached(GBASystem& gba, int budget) {
+    const uint64_t start = cycles;
+    const uint64_t deadline = cycles + budget;
+    yield_requested = false;
+
+    // Blocks are found by the address of their first instruction, so drop any prefetched state
+    if (!pipeline_flushed) {
+        registers[15] -= thumb_mode ? 4 : 8;
+        flush_pipeline();
+    }
+
+    // IRQs are only taken between blocks; see run_interpreter() for why sampling once is enough
+    const bool irq_line = gba.has_pending_interrupts();
+    const bool tiered = execution_mode == ExecutionMode::TIERED;
+    const bool native = (execution_mode == ExecutionMode::JIT || tiered) && prepare_jit(gba);
+    // Translated blocks chain into each other only while no IRQ can be taken
+    jit_context.chain_deadline = irq_line ? 0 : deadline;
+    if (predecoder) merge_predecoded(native);
+
+    while (cycles < deadline) {
+        if (code_invalidated) {
+            block_cache.release_retired();
+            code_invalidated = false;
+        }
+
+        if (irq_line && !(cpsr & FLAG_I)) {
+            handle_irq(gba);
+            break;
+        }
+        if (!idle_loop_addresses.empty() && skip_configured_idle_loop(registers[15], deadline)) break;
+
+        CachedBlock* block = block_cache.find(registers[15], thumb_mode);
+        if (!block) {
+            // Cold code is not worth decoding until it has been entered a few times
+            if (tiered && ++block_cache.entry_count(registers[15], thumb_mode) <= tier_thresholds.block_cache) {
+                interpret_until_branch(gba, deadline);
+                if (yield_requested) break;
+                continue;
+            }
+            block = build_block(gba, registers[15]);
+        }
+
+        if (block && block->idle_loop) {
+            // Replayed rather than translated, so a self-linked translation cannot spin to the
+            // deadline. One iteration sees the latest state; if it loops back, so would the rest.
+            const uint64_t iteration_start = cycles;
+            execute_block(gba, *block);
+            if (registers[15] == block->start) skip_idle_iterations(deadline, cycles - iteration_start);
+        } else if (block) {
+            const bool hot = !tiered || block->native || ++block->executions > tier_thresholds.jit;
+            if (!native || !hot || !execute_native(*block)) {
+                execute_block(gba, *block);
+            }
+        } else {
+            // Not cacheable: interpret a single instruction and go back to block lookup
+            step(gba);
+            if (!pipeline_flushed) {
+                registers[15] -= thumb_mode ? 4 : 8;
+                flush_pipeline();
+            }
+        }
+
+        if (yield_requested) break;
+    }
+
+    return static_cast<int>(cycles - start);
+}
+
+void ARM7CPU::skip_idle_iterations(uint64_t deadline, uint64_t period) {
+    if (period == 0 || cycles >= deadline) return;
+    // Whole iterations, so cycles ends where running the loop to the deadline would leave it
+    const uint64_t skipped = (deadline - cycles + period - 1) / period * period;
+    cycles += skipped;
+    idle_cycles_skipped += skipped;
+}
+
+bool ARM7CPU::skip_configured_idle_loop(uint32_t address, uint64_t deadline) {
+    if (!idle_loop_addresses.contains(address)) return false;
+    if (idle_arrival != address) {
+        // First arrival this slice: run an iteration against the latest state
+        idle_arrival = address;
+        idle_arrival_cycles = cycles;
+        return false;
+    }
+    skip_idle_iterations(deadline, cycles - idle_arrival_cycles);
+    return true;
+}
@@ -0,0 +1,186 @@
+// cpu/code_cache_file.cpp
+#include "arm7_cpu.h"
+#include "../system.h"
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+// Layout (host byte order, as the file never leaves the machine that wrote it):
+//   header:  "BGCC", format version, ROM hash, JIT build id, block count
+//   block:   start, thumb, op count, executions, translated code size (0 if none)
+//   code:    entry offset, referenced offset, cell count, cells, code bytes
+constexpr uint32_t CODE_CACHE_MAGIC = 0x43434742;  // "BGCC"
+constexpr uint32_t CODE_CACHE_VERSION = 1;
+
+namespace {
+
+struct BlockRecord {
+    uint32_t start = 0;
+    bool thumb = false;
+    uint32_t op_count = 0;
+    uint32_t executions = 0;
+    JitTranslation translation;
+};
+
+std::string code_cache_filename(const std::string& directory, uint64_t rom_hash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bgcc", static_cast<unsigned long long>(rom_hash));
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+template <typename T>
+bool write_value(std::FILE* file, const T& value) {
+    return std::fwrite(&value, sizeof(T), 1, file) == 1;
+}
+
+template <typename T>
+bool read_value(std::FILE* file, T& value) {
+    return std::fread(&value, sizeof(T), 1, file) == 1;
+}
+
+bool write_block(std::FILE* file, const BlockRecord& record) {
+    const JitTranslation& translation = record.translation;
+    const uint32_t code_size = static_cast<uint32_t>(translation.code.size());
+    const uint32_t cell_count = static_cast<uint32_t>(translation.cells.size());
+    bool ok = write_value(file, record.start) && write_value(file, static_cast<uint8_t>(record.thumb)) &&
+              write_value(file, record.op_count) && write_value(file, record.executions) &&
+              write_value(file, code_size);
+    if (!ok || code_size == 0) return ok;
+    return write_value(file, translation.entry_offset) && write_value(file, translation.referenced) &&
+           write_value(file, cell_count) &&
+           std::fwrite(translation.cells.data(), sizeof(JitTranslation::Cell), cell_count, file) == cell_count &&
+           std::fwrite(translation.code.data(), 1, code_size, file) == code_size;
+}
+
+bool read_block(std::FILE* file, BlockRecord& record) {
+    uint8_t thumb;
+    uint32_t code_size;
+    if (!read_value(file, record.start) || !read_value(file, thumb) || !read_value(file, record.op_count) ||
+        !read_value(file, record.executions) || !read_value(file, code_size)) {
+        return false;
+    }
+    record.thumb = thumb != 0;
+    if (code_size == 0) return true;
+
+    JitTranslation& translation = record.translation;
+    uint32_t cell_count;
+    if (!read_value(file, translation.entry_offset) || !read_value(file, translation.referenced) ||
+        !read_value(file, cell_count)) {
+        return false;
+    }
+    // Every cell is 8 bytes of the code, which bounds the count before anything is allocated
+    if (cell_count > code_size / 8 || translation.referenced >= code_size || translation.entry_offset >= code_size) {
+        return false;
+    }
+    translation.cells.resize(cell_count);
+    translation.code.resize(code_size);
+    if (std::fread(translation.cells.data(), sizeof(JitTranslation::Cell), cell_count, file) != cell_count ||
+        std::fread(translation.code.data(), 1, code_size, file) != code_size) {
+        return false;
+    }
+    for (const JitTranslation::Cell& cell : translation.cells) {
+        if (cell.offset > code_size - 8) return false;
+        if (cell.unlinked != JitTranslation::RETURN_CELL && cell.unlinked >= code_size) return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+bool ARM7CPU::save_code_cache(GBASystem& gba, const std::string& directory, bool include_native) {
+    // Only ROM blocks are saved: RAM holds different code from run to run
+    std::vector<BlockRecord> records;
+    block_cache.for_each([&](const CachedBlock& block) {
+        if (block.start < ROM_START) return;
+        BlockRecord record;
+        record.start = block.start;
+        record.thumb = block.thumb;
+        record.op_count = static_cast<uint32_t>(block.ops.size());
+        record.executions = block.executions;
+#ifdef JIT_X64
+        // Translation is deterministic, so translating again reproduces the code that ran
+        if (include_native && block.native) record.translation = JitCompiler::translate(*this, block);
+#endif
+        records.push_back(std::move(record));
+    });
+
+    const std::string filename = code_cache_filename(directory, gba.memory.rom_hash());
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) return false;
+
+#ifdef JIT_X64
+    const uint64_t build = JitCompiler::build_id(*this);
+#else
+    const uint64_t build = 0;
+#endif
+    const uint32_t count = static_cast<uint32_t>(records.size());
+    bool ok = write_value(file, CODE_CACHE_MAGIC) && write_value(file, CODE_CACHE_VERSION) &&
+              write_value(file, gba.memory.rom_hash()) && write_value(file, build) && write_value(file, count);
+    for (uint32_t i = 0; i < count && ok; i++) {
+        ok = write_block(file, records[i]);
+    }
+
+    #ifdef DEBUG_CODE_CACHE
+    std::cout << "Code cache: saved " << count << " blocks to " << filename << std::endl;
+    #endif
+
+    return std::fclose(file) == 0 && ok;
+}
+
+bool ARM7CPU::load_code_cache(GBASystem& gba, const std::string& directory) {
+    const uint64_t rom_hash = gba.memory.rom_hash();
+    const std::string filename = code_cache_filename(directory, rom_hash);
+    std::FILE* file = std::fopen(filename.c_str(), "rb");
+    if (!file) return false;
+
+    // Read everything before touching the cache, so a truncated file changes nothing
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint64_t file_rom_hash = 0;
+    uint64_t build = 0;
+    uint32_t count = 0;
+    bool ok = read_value(file, magic) && read_value(file, version) && read_value(file, file_rom_hash) &&
+              read_value(file, build) && read_value(file, count) && magic == CODE_CACHE_MAGIC &&
+              version == CODE_CACHE_VERSION && file_rom_hash == rom_hash;
+    std::vector<BlockRecord> records;
+    while (ok && records.size() < count) {
+        BlockRecord record;
+        ok = read_block(file, record);
+        records.push_back(std::move(record));
+    }
+    std::fclose(file);
+    if (!ok) return false;
+
+    // Blocks are decoded again from the ROM rather than trusting the file; one that comes out
+    // different keeps none of its saved state
+    const bool saved_thumb = thumb_mode;
+    std::vector<std::pair<CachedBlock*, const JitTranslation*>> translated;
+    for (const BlockRecord& record : records) {
+        if (record.start < ROM_START || block_cache.find(record.start, record.thumb)) continue;
+        thumb_mode = record.thumb;
+        CachedBlock* block = build_block(gba, record.start);
+        if (!block) continue;
+        if (block->ops.size() != record.op_count) continue;
+        block->executions = record.executions;
+        if (!record.translation.code.empty() && translatable(*block)) translated.push_back({block, &record.translation});
+    }
+    thumb_mode = saved_thumb;
+
+#ifdef JIT_X64
+    // Install translations once every block exists, so each one links to the others
+    const bool native = execution_mode == ExecutionMode::JIT || execution_mode == ExecutionMode::TIERED;
+    if (native && build == JitCompiler::build_id(*this) && prepare_jit(gba)) {
+        for (auto& [block, translation] : translated) {
+            block->native = jit->install(*this, *block, *translation);
+            if (block->native) jit->link(*block);
+        }
+    }
+#endif
+
+    #ifdef DEBUG_CODE_CACHE
+    std::cout << "Code cache: loaded " << records.size() << " blocks (" << translated.size()
+              << " translated) from " << filename << std::endl;
+    #endif
+
+    return true;
+}
@@ -0,0 +1,21 @@
+// cpu/cpu_trace.cpp
+#include "cpu_trace.h"
+#include <cstdio>
+
+bool TraceBuffer::dump(const std::string& filename) const {
+    // stdio rather than iostreams so this can be called from a crash handler
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) return false;
+
+    const uint32_t count = size();
+    const uint32_t header[3] = {0x52544742, 1, count};  // "BGTR", format version, record count
+    bool ok = std::fwrite(header, sizeof(header), 1, file) == 1;
+
+    // The oldest record sits at head once the buffer has wrapped
+    const uint64_t first = head - count;
+    for (uint32_t i = 0; i < count && ok; i++) {
+        ok = std::fwrite(&records[(first + i) & (capacity - 1)], sizeof(TraceRecord), 1, file) == 1;
+    }
+
+    return std::fclose(file) == 0 && ok;
+}
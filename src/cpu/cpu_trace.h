@@ -0,0 +1,42 @@
+// cpu/cpu_trace.h
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Number of records kept by the trace ring buffer (must be a power of two)
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY 16384
+#endif
+
+// One executed instruction, as written to trace dumps
+struct TraceRecord {
+    uint32_t pc;
+    uint32_t opcode;
+    uint32_t cpsr;
+    uint32_t cycle;
+};
+
+// Fixed-size binary ring buffer of the most recently executed instructions.
+// Only built with DEBUG_TRACE; recording is a store and an index bump, with no formatting.
+class TraceBuffer {
+public:
+    static constexpr uint32_t capacity = TRACE_CAPACITY;
+    static_assert((capacity & (capacity - 1)) == 0, "TRACE_CAPACITY must be a power of two");
+
+    void record(uint32_t pc, uint32_t opcode, uint32_t cpsr, uint32_t cycle) {
+        records[head & (capacity - 1)] = {pc, opcode, cpsr, cycle};
+        head++;
+    }
+
+    void clear() { head = 0; }
+    uint32_t size() const { return head < capacity ? static_cast<uint32_t>(head) : capacity; }
+
+    // Write the buffered records, oldest first, after a small header ("BGTR", version, count)
+    bool dump(const std::string& filename) const;
+
+private:
+    std::array<TraceRecord, capacity> records{};
+    uint64_t head = 0;  // Total records written; the capacity mask turns it into an index
+};
@@ -0,0 +1,266 @@
+// cpu/idle_loop.cpp
+#include "idle_loop.h"
+#include "arm7_cpu.h"
+
+// Guest state followed by the analysis: R0-R14 in bits 0-14, then the flags. NZ are always
+// written together; C and V are tracked apart, as logical operations keep V and sometimes C.
+constexpr uint32_t STATE_NZ = 1u << 16;
+constexpr uint32_t STATE_C = 1u << 17;
+constexpr uint32_t STATE_V = 1u << 18;
+constexpr uint32_t STATE_NZCV = STATE_NZ | STATE_C | STATE_V;
+
+namespace {
+
+// What one instruction reads and writes. R15 reads as the instruction's own address plus 8 (or
+// 4), the same on every iteration, so it never counts as a use.
+struct Access {
+    uint32_t uses = 0;
+    uint32_t defs = 0;
+
+    void use(uint32_t reg) {
+        if (reg != 15) uses |= 1u << reg;
+    }
+    void def(uint32_t reg) { defs |= 1u << reg; }
+};
+
+// Fill in access for an instruction allowed in an idle loop: loads, data processing and compares
+// that leave R15 alone. False for anything else.
+bool arm_access(uint32_t instruction, Access& access) {
+    const uint32_t rn = (instruction >> 16) & 0xF;
+    const uint32_t rd = (instruction >> 12) & 0xF;
+    const uint32_t rm = instruction & 0xF;
+    if (rd == 15) return false;
+
+    if ((instruction & 0x0E000090) == 0x00000090 && (instruction & 0x60)) {
+        // LDRH, LDRSB, LDRSH
+        if (!(instruction & (1 << 20))) return false;
+        access.use(rn);
+        if (!(instruction & (1 << 22))) access.use(rm);
+        if (!(instruction & (1 << 24)) || (instruction & (1 << 21))) access.def(rn);
+        access.def(rd);
+        return true;
+    }
+
+    if ((instruction & 0x0C000000) == 0x00000000) {
+        const bool immediate = (instruction & (1 << 25)) != 0;
+        const uint32_t opcode = (instruction >> 21) & 0xF;
+        const bool set_flags = (instruction & (1 << 20)) != 0;
+        const bool test = (opcode & 0xC) == 0x8;
+        if (!immediate && (instruction & 0x90) == 0x90) return false;  // Multiply, swap
+        if (test && !set_flags) return false;                           // MRS, MSR
+
+        // The shifter carry replaces C for logical operations, except for LSL #0 and unrotated
+        // immediates; a register amount of zero passes the old C through
+        bool shifter_sets_c = true;
+        bool shifter_keeps_c = false;
+        if (immediate) {
+            shifter_sets_c = ((instruction >> 8) & 0xF) != 0;
+        } else if (instruction & (1 << 4)) {
+            access.use(rm);
+            access.use((instruction >> 8) & 0xF);
+            shifter_keeps_c = true;
+        } else {
+            const uint32_t shift_type = (instruction >> 5) & 3;
+            const uint32_t amount = (instruction >> 7) & 0x1F;
+            access.use(rm);
+            if (shift_type == 3 && amount == 0) access.uses |= STATE_C;  // RRX
+            shifter_sets_c = shift_type != 0 || amount != 0;
+        }
+
+        if (opcode != 0xD && opcode != 0xF) access.use(rn);  // All but MOV and MVN
+        if (opcode >= 0x5 && opcode <= 0x7) access.uses |= STATE_C;  // ADC, SBC, RSC
+        if (!test) access.def(rd);
+        if (set_flags) {
+            const bool arithmetic = (opcode >= 0x2 && opcode <= 0x7) || opcode == 0xA || opcode == 0xB;
+            if (arithmetic) {
+                access.defs |= STATE_NZCV;
+            } else {
+                access.defs |= STATE_NZ;
+                if (shifter_sets_c) access.defs |= STATE_C;
+                if (shifter_keeps_c) access.uses |= STATE_C;
+            }
+        }
+        return true;
+    }
+
+    if ((instruction & 0x0C000000) == 0x04000000) {
+        // LDR, LDRB
+        if (!(instruction & (1 << 20))) return false;
+        const bool register_offset = (instruction & (1 << 25)) != 0;
+        if (register_offset && (instruction & (1 << 4))) return false;  // Undefined
+        access.use(rn);
+        if (register_offset) {
+            access.use(rm);
+            if (((instruction >> 5) & 3) == 3 && ((instruction >> 7) & 0x1F) == 0) access.uses |= STATE_C;
+        }
+        if (!(instruction & (1 << 24)) || (instruction & (1 << 21))) access.def(rn);
+        access.def(rd);
+        return true;
+    }
+
+    return false;
+}
+
+bool thumb_access(uint16_t instruction, Access& access) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t rs = (instruction >> 3) & 7;
+
+    if ((instruction & 0xF800) == 0x1800) {
+        // ADD/SUB register or 3-bit immediate
+        access.use(rs);
+        if (!(instruction & (1 << 10))) access.use((instruction >> 6) & 7);
+        access.def(rd);
+        access.defs |= STATE_NZCV;
+        return true;
+    }
+    if ((instruction & 0xE000) == 0x0000) {
+        // Shift by immediate; LSL #0 keeps C
+        access.use(rs);
+        access.def(rd);
+        access.defs |= STATE_NZ;
+        if ((instruction & 0x1FC0) != 0) access.defs |= STATE_C;
+        return true;
+    }
+    if ((instruction & 0xE000) == 0x2000) {
+        // MOV, CMP, ADD, SUB with an 8-bit immediate
+        const uint32_t op = (instruction >> 11) & 3;
+        const uint32_t reg = (instruction >> 8) & 7;
+        if (op != 0) access.use(reg);
+        if (op != 1) access.def(reg);
+        access.defs |= op == 0 ? STATE_NZ : STATE_NZCV;
+        return true;
+    }
+    if ((instruction & 0xFC00) == 0x4000) {
+        const uint32_t op = (instruction >> 6) & 0xF;
+        if (op != 0x9 && op != 0xF) access.use(rd);  // All but NEG and MVN read Rd
+        access.use(rs);
+        if (op != 0x8 && op != 0xA && op != 0xB) access.def(rd);  // TST, CMP and CMN only compare
+        switch (op) {
+            case 0x2: case 0x3: case 0x4: case 0x7:
+                // Register shifts keep C when the amount is zero
+                access.uses |= STATE_C;
+                access.defs |= STATE_NZ | STATE_C;
+                break;
+            case 0x5: case 0x6:
+                // ADC, SBC
+                access.uses |= STATE_C;
+                access.defs |= STATE_NZCV;
+                break;
+            case 0x9: case 0xA: case 0xB:
+                // NEG, CMP, CMN
+                access.defs |= STATE_NZCV;
+                break;
+            default:
+                access.defs |= STATE_NZ;
+                break;
+        }
+        return true;
+    }
+    if ((instruction & 0xFC00) == 0x4400) {
+        // Hi register ADD, CMP and MOV; BX and writes to R15 end the loop some other way
+        const uint32_t op = (instruction >> 8) & 3;
+        const uint32_t high_rd = rd | ((instruction >> 4) & 8);
+        const uint32_t high_rs = (instruction >> 3) & 0xF;
+        if (op == 3 || (op != 1 && high_rd == 15)) return false;
+        if (op != 2) access.use(high_rd);
+        access.use(high_rs);
+        if (op == 1) {
+            access.defs |= STATE_NZCV;
+        } else {
+            access.def(high_rd);
+        }
+        return true;
+    }
+    if ((instruction & 0xF800) == 0x4800) {
+        // PC-relative load
+        access.def((instruction >> 8) & 7);
+        return true;
+    }
+    if ((instruction & 0xF000) == 0x5000) {
+        // Register offset loads; STR, STRB and STRH are the forms that store
+        const bool load = (instruction & (1 << 9)) ? (instruction & 0x0C00) != 0 : (instruction & (1 << 11)) != 0;
+        if (!load) return false;
+        access.use(rs);
+        access.use((instruction >> 6) & 7);
+        access.def(rd);
+        return true;
+    }
+    if ((instruction & 0xE000) == 0x6000 || (instruction & 0xF000) == 0x8000) {
+        // Word, byte and halfword loads with an immediate offset
+        if (!(instruction & (1 << 11))) return false;
+        access.use(rs);
+        access.def(rd);
+        return true;
+    }
+    if ((instruction & 0xF000) == 0x9000) {
+        // SP-relative load
+        if (!(instruction & (1 << 11))) return false;
+        access.use(13);
+        access.def((instruction >> 8) & 7);
+        return true;
+    }
+    if ((instruction & 0xF000) == 0xA000) {
+        // ADD Rd, PC/SP, #imm
+        if (instruction & (1 << 11)) access.use(13);
+        access.def((instruction >> 8) & 7);
+        return true;
+    }
+    return false;
+}
+
+// Whether the block's final instruction branches back to the block start, and if so what it reads
+bool branches_to_start(const CachedBlock& block, Access& access) {
+    const MicroOp& op = block.ops.back();
+    if (block.thumb) {
+        const uint32_t address = block.start + static_cast<uint32_t>(block.ops.size() - 1) * 2;
+        const uint16_t instruction = static_cast<uint16_t>(op.opcode);
+        int32_t offset;
+        if ((instruction & 0xF000) == 0xD000 && ((instruction >> 8) & 0xF) < 0xE) {
+            access.uses |= STATE_NZCV;
+            offset = static_cast<int8_t>(instruction & 0xFF) * 2;
+        } else if ((instruction & 0xF800) == 0xE000) {
+            offset = static_cast<int32_t>(static_cast<uint32_t>(instruction) << 21) >> 20;
+        } else {
+            return false;
+        }
+        return address + 4 + offset == block.start;
+    }
+
+    const uint32_t address = block.start + static_cast<uint32_t>(block.ops.size() - 1) * 4;
+    if ((op.opcode & 0x0F000000) != 0x0A000000 || op.condition == 0xF) return false;  // B without link
+    if (op.condition != CONDITION_ALWAYS) access.uses |= STATE_NZCV;
+    const int32_t offset = static_cast<int32_t>(op.opcode << 8) >> 6;
+    return address + 8 + offset == block.start;
+}
+
+}  // namespace
+
+bool is_idle_loop(const CachedBlock& block) {
+    if (block.ops.empty() || block.ops.size() > IDLE_LOOP_MAX_OPS) return false;
+
+    uint32_t defined = 0;   // Written on every pass through the iteration so far
+    uint32_t written = 0;   // Written on some pass
+    uint32_t carried = 0;   // Read before the iteration writes them, so from the previous one
+
+    for (size_t index = 0; index < block.ops.size(); index++) {
+        const MicroOp& op = block.ops[index];
+        Access access;
+        bool conditional = false;
+        if (index + 1 == block.ops.size()) {
+            if (!branches_to_start(block, access)) return false;
+        } else if (block.thumb) {
+            if (!thumb_access(static_cast<uint16_t>(op.opcode), access)) return false;
+        } else {
+            if (op.condition == 0xF || !arm_access(op.opcode, access)) return false;
+            conditional = op.condition != CONDITION_ALWAYS;
+            if (conditional) access.uses |= STATE_NZCV;
+        }
+
+        carried |= access.uses & ~defined;
+        written |= access.defs;
+        if (!conditional) defined |= access.defs;
+    }
+
+    // Anything carried that the loop also changes could make the next iteration differ
+    return (carried & written) == 0;
+}
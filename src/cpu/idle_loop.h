@@ -0,0 +1,15 @@
+// cpu/idle_loop.h
+#pragma once
+
+#include <cstdint>
+#include "block_cache.h"
+
+// Longest block considered for idle loop detection
+constexpr uint32_t IDLE_LOOP_MAX_OPS = 16;
+
+// True if block is a loop that waits for memory to change: it ends in a branch back to its own
+// start, makes no stores, and every register or flag it carries from one iteration to the next
+// is one it never changes. Each iteration then repeats the previous one exactly until a load
+// returns something new, which within one run() slice (no PPU progress, no IRQ) never happens.
+// Loads only read state, so polling I/O (VCOUNT, DISPSTAT, IF) or RAM is allowed.
+bool is_idle_loop(const CachedBlock& block);
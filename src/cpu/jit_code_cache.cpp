@@ -0,0 +1,142 @@
+// cpu/jit_code_cache.cpp
+#include "jit_code_cache.h"
+#include "jit_x64.h"
+
+#ifdef JIT_X64
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <sys/mman.h>
+
+ExecutableMemory::ExecutableMemory(size_t capacity) : capacity(capacity) {
+    // Hosts that refuse writable+executable mappings simply run without the JIT
+    void* memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED) {
+        base = static_cast<uint8_t*>(memory);
+    }
+}
+
+ExecutableMemory::~ExecutableMemory() {
+    if (base) munmap(base, capacity);
+}
+
+// Cells may be read by translated code running on other threads (shared cache)
+static void store_cell(const uint8_t** cell, const uint8_t* value) {
+    std::atomic_ref<const uint8_t*>(*cell).store(value, std::memory_order_release);
+}
+
+void LinkTable::link(uint32_t target, const uint8_t* entry) {
+    auto it = sites.find(target);
+    if (it == sites.end()) return;
+    for (const LinkSite& site : it->second) store_cell(site.cell, entry);
+}
+
+void LinkTable::unlink(uint32_t target) {
+    auto it = sites.find(target);
+    if (it == sites.end()) return;
+    for (const LinkSite& site : it->second) store_cell(site.cell, site.unlinked);
+}
+
+void LinkTable::remove(uint32_t target, const uint8_t* begin, const uint8_t* end) {
+    auto it = sites.find(target);
+    if (it == sites.end()) return;
+    std::erase_if(it->second, [&](const LinkSite& site) {
+        const uint8_t* cell = reinterpret_cast<const uint8_t*>(site.cell);
+        return cell >= begin && cell < end;
+    });
+    if (it->second.empty()) sites.erase(it);
+}
+
+CodeCache::CodeCache(size_t budget) : memory(budget) {
+    clear();
+}
+
+void CodeCache::clear() {
+    residents.clear();
+    hand = residents.end();
+    free_ranges.clear();
+    if (valid()) free_ranges[0] = static_cast<uint32_t>(memory.size());
+    bytes_used = 0;
+}
+
+uint8_t* CodeCache::take(uint32_t size) {
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        if (it->second < size) continue;
+        const uint32_t offset = it->first;
+        const uint32_t remaining = it->second - size;
+        free_ranges.erase(it);
+        if (remaining) free_ranges[offset + size] = remaining;
+        bytes_used += size;
+        return memory.data() + offset;
+    }
+    return nullptr;
+}
+
+void CodeCache::release(uint32_t offset, uint32_t size) {
+    bytes_used -= size;
+    auto next = free_ranges.lower_bound(offset);
+    if (next != free_ranges.end() && offset + size == next->first) {
+        size += next->second;
+        next = free_ranges.erase(next);
+    }
+    if (next != free_ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += size;
+            return;
+        }
+    }
+    free_ranges[offset] = size;
+}
+
+uint8_t* CodeCache::allocate(uint32_t size, const std::function<void(const Resident&)>& evict) {
+    if (!valid() || size > memory.size()) return nullptr;
+
+    while (true) {
+        if (uint8_t* code = take(size)) return code;
+        if (residents.empty()) return nullptr;
+
+        if (hand == residents.end()) hand = residents.begin();
+        if (*hand->referenced) {
+            *hand->referenced = 0;
+            ++hand;
+            continue;
+        }
+        evict(*hand);
+        release(static_cast<uint32_t>(hand->code - memory.data()), hand->size);
+        hand = residents.erase(hand);
+    }
+}
+
+std::shared_ptr<SharedCodeCache> SharedCodeCache::for_rom(uint64_t rom_hash, const std::unordered_set<uint32_t>& idle_loops,
+                                                          size_t capacity) {
+    static std::mutex registry_mutex;
+    static std::unordered_map<uint64_t, std::weak_ptr<SharedCodeCache>> registry;
+
+    // FNV-1a of the sorted idle loop addresses, continuing from the ROM hash
+    std::vector<uint32_t> addresses(idle_loops.begin(), idle_loops.end());
+    std::sort(addresses.begin(), addresses.end());
+    uint64_t key = rom_hash;
+    for (uint32_t address : addresses) {
+        for (int shift = 0; shift < 32; shift += 8) key = (key ^ ((address >> shift) & 0xFF)) * 0x100000001B3ull;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::shared_ptr<SharedCodeCache> cache = registry[key].lock();
+    if (!cache) {
+        cache = std::make_shared<SharedCodeCache>(capacity);
+        registry[key] = cache;
+    }
+    return cache;
+}
+
+uint8_t* SharedCodeCache::append(const uint8_t* code, size_t size) {
+    if (!memory.data() || size > memory.size() - used) return nullptr;
+    uint8_t* destination = memory.data() + used;
+    std::memcpy(destination, code, size);
+    used = std::min(memory.size(), (used + size + 15) & ~size_t{15});
+    return destination;
+}
+
+#endif
@@ -0,0 +1,129 @@
+// cpu/jit_code_cache.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Counters for one JIT instance
+struct JitCacheStats {
+    uint64_t hits = 0;          // Dispatches to a block that was already translated
+    uint64_t misses = 0;        // Dispatches that had to translate first
+    uint64_t shared_hits = 0;   // Misses served from the cross-instance cache
+    uint64_t evictions = 0;
+    size_t bytes_used = 0;      // Private code cache
+    size_t bytes_budget = 0;
+};
+
+// Writable and executable memory from the OS; data() is nullptr if the host refused it
+class ExecutableMemory {
+public:
+    explicit ExecutableMemory(size_t capacity);
+    ~ExecutableMemory();
+    ExecutableMemory(const ExecutableMemory&) = delete;
+    ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+
+    uint8_t* data() const { return base; }
+    size_t size() const { return capacity; }
+
+private:
+    uint8_t* base = nullptr;
+    size_t capacity = 0;
+};
+
+// A pointer-sized cell in translated code that an exit jumps through. Linking stores the
+// target block's entry in it; unlinking restores the exit's own fallback path.
+struct LinkSite {
+    const uint8_t** cell;
+    const uint8_t* unlinked;    // nullptr for return-address stack cells
+};
+
+// Link sites grouped by the key of the block they lead to
+class LinkTable {
+public:
+    void add(uint32_t target, LinkSite site) { sites[target].push_back(site); }
+    void link(uint32_t target, const uint8_t* entry);
+    void unlink(uint32_t target);
+
+    // Forget the sites inside [begin, end) before that code is freed
+    void remove(uint32_t target, const uint8_t* begin, const uint8_t* end);
+    void clear() { sites.clear(); }
+
+private:
+    std::unordered_map<uint32_t, std::vector<LinkSite>> sites;
+};
+
+// One instance's translations within a byte budget. Space is handed out first fit; when it
+// runs out, blocks are evicted in clock order, sparing once those entered since the hand last
+// passed them.
+class CodeCache {
+public:
+    struct Resident {
+        uint32_t key;
+        uint8_t* code;
+        uint32_t size;
+        uint8_t* referenced;            // Set by the block's own code on every entry
+        std::vector<uint32_t> targets;  // Keys its link sites are registered under
+    };
+
+    explicit CodeCache(size_t budget);
+
+    bool valid() const { return memory.data() != nullptr; }
+    size_t budget() const { return memory.size(); }
+    size_t used() const { return bytes_used; }
+
+    // Reserve size bytes (a multiple of 16), calling evict for each block that has to go first.
+    // nullptr if size exceeds the whole budget.
+    uint8_t* allocate(uint32_t size, const std::function<void(const Resident&)>& evict);
+
+    // Start tracking code placed by allocate()
+    void insert(Resident resident) { residents.insert(hand, std::move(resident)); }
+
+    void clear();
+
+private:
+    ExecutableMemory memory;
+    std::map<uint32_t, uint32_t> free_ranges;  // Offset -> size, never adjacent
+    std::list<Resident> residents;
+    std::list<Resident>::iterator hand;
+    size_t bytes_used = 0;
+
+    uint8_t* take(uint32_t size);
+    void release(uint32_t offset, uint32_t size);
+};
+
+// Translations of ROM code shared by every instance running the same ROM in one process. The
+// registry behind for_rom() is process-local: separate emulator processes each translate for
+// themselves, and can only start from the same translations through a code cache file
+// (ARM7CPU::save_code_cache()). ROM never changes, so entries are never invalidated or evicted;
+// once it is full, instances translate privately. Entries only link to each other, so no
+// instance's private cache can pull code out from under it.
+class SharedCodeCache {
+public:
+    explicit SharedCodeCache(size_t capacity) : memory(capacity) {}
+
+    // The cache for a ROM in this process, created on first use and dropped with its last user.
+    // Instances with different idle loops (ARM7CPU::idle_loop_addresses) get different caches,
+    // as the code does not link to the blocks at those addresses.
+    static std::shared_ptr<SharedCodeCache> for_rom(uint64_t rom_hash, const std::unordered_set<uint32_t>& idle_loops,
+                                                    size_t capacity);
+
+    // Copy code in; nullptr when full
+    uint8_t* append(const uint8_t* code, size_t size);
+
+    std::mutex mutex;                                       // Guards everything below
+    std::unordered_map<uint32_t, const uint8_t*> blocks;    // Block key -> code
+    uint32_t entry_offset = 0;                              // Chain entry within each block
+    LinkTable links;
+
+private:
+    ExecutableMemory memory;
+    size_t used = 0;
+};
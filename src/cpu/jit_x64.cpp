@@ -0,0 +1,1251 @@
+// cpu/jit_x64.cpp
+#include "jit_x64.h"
+#include "arm7_cpu.h"
+#include "alu.h"
+#include "../system.h"
+
+#ifdef JIT_X64
+
+#include "x64_emitter.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <string>
+#include <vector>
+
+uint32_t JitCompiler::read32(ARM7CPU* cpu, uint32_t address) {
+    return read_word_rotated(cpu->jit_context.gba->memory, address);
+}
+
+uint32_t JitCompiler::read8(ARM7CPU* cpu, uint32_t address) {
+    return cpu->jit_context.gba->memory.read8(address);
+}
+
+void JitCompiler::write32(ARM7CPU* cpu, uint32_t address, uint32_t value) {
+    cpu->jit_context.gba->memory.write32(address, value);
+}
+
+void JitCompiler::write8(ARM7CPU* cpu, uint32_t address, uint32_t value) {
+    cpu->jit_context.gba->memory.write8(address, static_cast<uint8_t>(value));
+}
+
+void JitCompiler::log_store(ARM7CPU* cpu, uint32_t address) {
+    cpu->jit_context.gba->memory.log_ram_words(address, 1);
+}
+
+uint32_t JitCompiler::check_condition(ARM7CPU* cpu, uint32_t condition) {
+    return cpu->check_condition(condition);
+}
+
+void JitCompiler::resolve_flags(ARM7CPU* cpu) {
+    cpu->flags.resolve();
+}
+
+void JitCompiler::bind(ARM7CPU& cpu, GBASystem& gba) {
+    JitContext& context = cpu.jit_context;
+    context.iwram = gba.memory.iwram.data();
+    context.ewram = gba.memory.ewram.data();
+    context.rom = gba.memory.rom.data();
+    context.rom_size = static_cast<uint32_t>(std::min<size_t>(gba.memory.rom.size(), ROM_SIZE)) & ~3u;
+    context.code_pages = gba.memory.code_pages.data();
+    context.log_stores = gba.memory.write_log != nullptr;
+    context.gba = &gba;
+    context.arm_table = ARM7CPU::arm_table.data();
+    context.thumb_table = ARM7CPU::thumb_table.data();
+    context.helpers[JIT_READ32] = reinterpret_cast<const void*>(&read32);
+    context.helpers[JIT_READ8] = reinterpret_cast<const void*>(&read8);
+    context.helpers[JIT_WRITE32] = reinterpret_cast<const void*>(&write32);
+    context.helpers[JIT_WRITE8] = reinterpret_cast<const void*>(&write8);
+    context.helpers[JIT_LOG_STORE] = reinterpret_cast<const void*>(&log_store);
+    context.helpers[JIT_CHECK_CONDITION] = reinterpret_cast<const void*>(&check_condition);
+    context.helpers[JIT_RESOLVE_FLAGS] = reinterpret_cast<const void*>(&resolve_flags);
+}
+
+// 16 guest register slots, sized so RSP stays 16-byte aligned at calls
+constexpr int32_t FRAME_SIZE = 72;
+
+// Callee-saved host registers that hold the most used guest registers
+constexpr X64Reg HOME_REGISTERS[] = {RBP, R12, R13, R14, R15};
+constexpr int NO_HOME = -1;
+
+// Emits the host code for one block. Entered as void(ARM7CPU*) with RBX holding the CPU.
+//
+// Guest registers live in host registers or stack slots for the whole block and are written
+// back at every exit and around every call into the interpreter. The condition flags are kept
+// in ARM7CPU::flags in exactly the LazyFlags form, so interpreted and translated instructions
+// can be freely mixed. R15 reads as a constant; anything writing R15 other than a branch goes
+// through the interpreter handler.
+class JitTranslator {
+public:
+    // With track_references, every entry sets a flag byte after the code for the cache's clock
+    JitTranslator(ARM7CPU& cpu, const CachedBlock& block, bool track_references)
+        : cpu(cpu), block(block), track_references(track_references) {
+        home.fill(NO_HOME);
+    }
+
+    // Exit and return-stack cells for JitCompiler to register once the code is placed
+    struct LinkRequest {
+        X64Emitter::Label cell;
+        X64Emitter::Label unlinked;
+        uint32_t target;            // Block key
+    };
+    struct CellRequest {
+        X64Emitter::Label cell;
+        uint32_t target;
+    };
+
+    std::vector<LinkRequest> link_requests;
+    std::vector<CellRequest> cell_requests;
+    uint32_t entry_offset = 0;
+    X64Emitter::Label referenced = 0;
+
+    JitTranslation translate() {
+        // The first pass only counts register uses, so the busiest registers can get host registers
+        emit_block();
+        allocate_registers();
+        e = X64Emitter{};
+        exits.clear();
+        link_requests.clear();
+        cell_requests.clear();
+        emit_block();
+
+        JitTranslation result;
+        result.entry_offset = entry_offset;
+        result.referenced = e.offset_of(referenced);
+        for (const LinkRequest& request : link_requests) {
+            result.cells.push_back({static_cast<uint32_t>(e.offset_of(request.cell)),
+                                    static_cast<uint32_t>(e.offset_of(request.unlinked)), request.target});
+        }
+        for (const CellRequest& request : cell_requests) {
+            result.cells.push_back({static_cast<uint32_t>(e.offset_of(request.cell)), JitTranslation::RETURN_CELL,
+                                    request.target});
+        }
+        result.code = std::move(e.code);
+        return result;
+    }
+
+private:
+    // How an out-of-line exit leaves the block
+    enum ExitKind {
+        EXIT_BRANCHED,          // An interpreter handler branched; R15 and registers are already set
+        EXIT_STOP_INTERPRETED,  // yield/invalidation inside an interpreter handler
+        EXIT_STOP,              // yield/invalidation inside a translated store
+        EXIT_RETURN             // A function return in an interpreter handler; tries the return stack
+    };
+
+    struct Exit {
+        X64Emitter::Label label;
+        ExitKind kind;
+        uint32_t next;
+        uint32_t executed;
+    };
+
+    ARM7CPU& cpu;
+    const CachedBlock& block;
+    const bool track_references;
+    X64Emitter e;
+    std::vector<Exit> exits;
+
+    std::array<int, 16> home{};             // Host register per guest register, or NO_HOME
+    std::array<uint32_t, 16> use_count{};
+    uint32_t used = 0;                      // Guest registers loaded on entry
+    uint32_t written = 0;                   // Guest registers stored back on exit
+
+    // Per-instruction state
+    uint32_t pc_value = 0;                  // What R15 reads as
+    uint32_t next_address = 0;
+    uint32_t executed = 0;                  // Instructions retired once the current one completes
+    int64_t prefix_lr = -1;                 // LR set by a Thumb BL prefix just before, if any
+
+    // Offsets into ARM7CPU
+    int32_t offset(const void* field) const {
+        return static_cast<int32_t>(static_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&cpu));
+    }
+    X64Mem field(const void* member) const { return {RBX, offset(member)}; }
+    X64Mem physical(uint32_t index) const { return {RBX, offset(&cpu.registers.physical[index])}; }
+    X64Mem helper(JitHelper id) const { return field(&cpu.jit_context.helpers[id]); }
+
+    // Guest register access through the block's homes
+    void read_reg(X64Reg dst, uint32_t reg) {
+        if (reg == 15) {
+            e.mov(dst, pc_value);
+            return;
+        }
+        use_count[reg]++;
+        used |= 1u << reg;
+        if (home[reg] != NO_HOME) {
+            e.mov(dst, static_cast<X64Reg>(home[reg]));
+        } else {
+            e.load(dst, {RSP, static_cast<int32_t>(reg * 4)});
+        }
+    }
+
+    void write_reg(uint32_t reg, X64Reg src) {
+        use_count[reg]++;
+        used |= 1u << reg;      // A conditional write still needs the old value on exit
+        written |= 1u << reg;
+        set_home(reg, src);
+    }
+
+    void set_home(uint32_t reg, X64Reg src) {
+        if (home[reg] != NO_HOME) {
+            e.mov(static_cast<X64Reg>(home[reg]), src);
+        } else {
+            e.store({RSP, static_cast<int32_t>(reg * 4)}, src);
+        }
+    }
+
+    // R8-R14 go through the bank map, as RegisterFile::operator[] does
+    void load_guest(X64Reg dst, uint32_t reg) {
+        if (reg < 8) {
+            e.load(dst, physical(reg));
+            return;
+        }
+        e.load_byte(dst, field(&cpu.registers.map[reg]));
+        e.load(dst, {RBX, offset(&cpu.registers.physical[0]), dst, 4});
+    }
+
+    // Clobbers RAX and RCX
+    void store_guest(uint32_t reg) {
+        if (reg < 8) {
+            e.store(physical(reg), RAX);
+            return;
+        }
+        e.load_byte(RCX, field(&cpu.registers.map[reg]));
+        e.store({RBX, offset(&cpu.registers.physical[0]), RCX, 4}, RAX);
+    }
+
+    void reload_registers() {
+        for (uint32_t reg = 0; reg < 15; reg++) {
+            if (!(used & (1u << reg))) continue;
+            load_guest(RAX, reg);
+            set_home(reg, RAX);
+        }
+    }
+
+    void write_back_registers() {
+        for (uint32_t reg = 0; reg < 15; reg++) {
+            if (!(written & (1u << reg))) continue;
+            if (home[reg] != NO_HOME) {
+                e.mov(RAX, static_cast<X64Reg>(home[reg]));
+            } else {
+                e.load(RAX, {RSP, static_cast<int32_t>(reg * 4)});
+            }
+            store_guest(reg);
+        }
+    }
+
+    void allocate_registers() {
+        std::array<uint32_t, 15> order;
+        for (uint32_t reg = 0; reg < 15; reg++) order[reg] = reg;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return use_count[a] > use_count[b];
+        });
+        home.fill(NO_HOME);
+        for (size_t i = 0; i < std::size(HOME_REGISTERS) && use_count[order[i]] > 0; i++) {
+            home[order[i]] = HOME_REGISTERS[i];
+        }
+    }
+
+    void call_helper(JitHelper id) {
+        e.mov64(RDI, RBX);
+        e.call(helper(id));
+    }
+
+    void prologue() {
+        e.push(RBX);
+        e.push(RBP);
+        e.push(R12);
+        e.push(R13);
+        e.push(R14);
+        e.push(R15);
+        e.alu64(ALU_SUB, RSP, FRAME_SIZE);
+        e.mov64(RBX, RDI);
+        // Linked blocks jump here with the frame and RBX already set up
+        entry_offset = e.position();
+        if (track_references) e.store_byte(referenced, 1);
+        reload_registers();
+    }
+
+    void epilogue() {
+        e.alu64(ALU_ADD, RSP, FRAME_SIZE);
+        e.pop(R15);
+        e.pop(R14);
+        e.pop(R13);
+        e.pop(R12);
+        e.pop(RBP);
+        e.pop(RBX);
+        e.ret();
+    }
+
+    // Leave with an empty pipeline at address, as execute_block() does
+    void exit_to(uint32_t address, uint32_t retired) {
+        e.store(physical(15), address);
+        e.store_byte(field(&cpu.pipeline_flushed), uint8_t{1});
+        e.alu64(ALU_ADD, field(&cpu.cycles), retired);
+        epilogue();
+    }
+
+    uint32_t key(uint32_t address) const { return address | static_cast<uint32_t>(block.thumb); }
+
+    // Leave for a constant address, continuing straight into its block once that is translated
+    // and there is budget left. Registers must already be written back.
+    void exit_linked(uint32_t address, uint32_t retired) {
+        const X64Emitter::Label unlinked = e.new_label();
+        add_cycles(retired);
+        e.load64(RAX, field(&cpu.cycles));
+        e.alu64(ALU_CMP, RAX, field(&cpu.jit_context.chain_deadline));
+        e.jcc(CC_AE, unlinked);
+        const X64Emitter::Label cell = e.new_label();
+        e.jmp_indirect(cell);
+        link_requests.push_back({cell, unlinked, key(address)});
+        e.bind(unlinked);
+        e.store(physical(15), address);
+        e.store_byte(field(&cpu.pipeline_flushed), uint8_t{1});
+        epilogue();
+    }
+
+    // Taken branch to a constant target; branch_to() adds the two refill cycles
+    void exit_branch(uint32_t target) {
+        write_back_registers();
+        exit_linked(target & (block.thumb ? ~1u : ~3u), executed + 2);
+    }
+
+    // Record a call's return address for the matching return
+    void push_return(uint32_t return_address) {
+        const X64Emitter::Label cell = e.new_label();
+        cell_requests.push_back({cell, key(return_address)});
+        e.load(RAX, field(&cpu.jit_context.return_top));
+        e.alu(ALU_ADD, RAX, 1u);
+        e.alu(ALU_AND, RAX, RETURN_STACK_SIZE - 1);
+        e.store(field(&cpu.jit_context.return_top), RAX);
+        e.shift(SHIFT_SHL, RAX, 4);
+        e.store({RBX, offset(&cpu.jit_context.return_stack[0].key), RAX, 1}, key(return_address));
+        e.lea(RCX, cell);
+        e.store64({RBX, offset(&cpu.jit_context.return_stack[0].entry), RAX, 1}, RCX);
+    }
+
+    // After a return: pop the return stack and, if it predicted this target and the target is
+    // translated, continue there directly
+    void return_to_predicted() {
+        const X64Emitter::Label miss = e.new_label();
+        e.load(RAX, field(&cpu.jit_context.return_top));
+        e.mov(RCX, RAX);
+        e.alu(ALU_SUB, RCX, 1u);
+        e.alu(ALU_AND, RCX, RETURN_STACK_SIZE - 1);
+        e.store(field(&cpu.jit_context.return_top), RCX);
+        e.shift(SHIFT_SHL, RAX, 4);
+        e.load_byte(RDX, field(&cpu.thumb_mode));
+        e.alu(ALU_OR, RDX, physical(15));
+        e.alu(ALU_CMP, RDX, {RBX, offset(&cpu.jit_context.return_stack[0].key), RAX, 1});
+        e.jcc(CC_NE, miss);
+        e.load64(RCX, {RBX, offset(&cpu.jit_context.return_stack[0].entry), RAX, 1});
+        e.load64(RCX, {RCX, 0});
+        e.test64(RCX, RCX);
+        e.jcc(CC_E, miss);
+        e.load64(RAX, field(&cpu.cycles));
+        e.alu64(ALU_CMP, RAX, field(&cpu.jit_context.chain_deadline));
+        e.jcc(CC_AE, miss);
+        e.store_byte(field(&cpu.pipeline_flushed), uint8_t{0});
+        e.jmp(RCX);
+        e.bind(miss);
+        epilogue();
+    }
+
+    static bool is_return(uint32_t opcode, bool thumb) {
+        if (thumb) return opcode == 0x4770 || (opcode & 0xFF00) == 0xBD00;  // BX LR, POP {..., PC}
+        return (opcode & 0x0FFFFFFF) == 0x012FFF1E ||   // BX LR
+               (opcode & 0x0FFFFFFF) == 0x01A0F00E ||   // MOV PC, LR
+               (opcode & 0x0FFF8000) == 0x08BD8000 ||   // LDMIA SP!, {..., PC}
+               (opcode & 0x0FFFFFFF) == 0x049DF004;     // LDR PC, [SP], #4
+    }
+
+    X64Emitter::Label exit_label(ExitKind kind) {
+        const X64Emitter::Label label = e.new_label();
+        exits.push_back({label, kind, next_address, executed});
+        return label;
+    }
+
+    void emit_exits() {
+        for (const Exit& exit : exits) {
+            e.bind(exit.label);
+            if (exit.kind == EXIT_BRANCHED || exit.kind == EXIT_RETURN) {
+                e.alu64(ALU_ADD, field(&cpu.cycles), exit.executed);
+                if (exit.kind == EXIT_RETURN) {
+                    return_to_predicted();
+                } else {
+                    epilogue();
+                }
+                continue;
+            }
+            if (exit.kind == EXIT_STOP) write_back_registers();
+            exit_to(exit.next, exit.executed);
+        }
+    }
+
+    // Stop after a store that may have set yield_requested or invalidated this block
+    void check_stop() {
+        const X64Emitter::Label stop = exit_label(EXIT_STOP);
+        e.cmp_byte(field(&cpu.yield_requested), 0);
+        e.jcc(CC_NE, stop);
+        e.cmp_byte(field(&cpu.code_invalidated), 0);
+        e.jcc(CC_NE, stop);
+    }
+
+    void add_cycles(uint32_t count) {
+        e.alu64(ALU_ADD, field(&cpu.cycles), count);
+    }
+
+    void emit_block() {
+        referenced = e.new_label();
+        prologue();
+
+        const uint32_t size = block.thumb ? 2 : 4;
+        uint32_t address = block.start;
+        for (const MicroOp& op : block.ops) {
+            pc_value = address + size * 2;
+            next_address = address + size;
+            executed++;
+            const int64_t previous_prefix = prefix_lr;
+            prefix_lr = -1;
+
+            if (block.thumb) {
+                if (!thumb_instruction(static_cast<uint16_t>(op.opcode), previous_prefix)) interpret(op.opcode);
+            } else {
+                const X64Emitter::Label skip = e.new_label();
+                condition(op.condition, skip);
+                if (!arm_instruction(op.opcode)) interpret(op.opcode);
+                e.bind(skip);
+            }
+            address = next_address;
+        }
+
+        // Fell off the end of the block
+        write_back_registers();
+        exit_linked(address, executed);
+        emit_exits();
+
+        // Cells are filled in by JitCompiler once the code is placed
+        e.align(8);
+        for (const LinkRequest& request : link_requests) {
+            e.bind(request.cell);
+            e.data64(0);
+        }
+        for (const CellRequest& request : cell_requests) {
+            e.bind(request.cell);
+            e.data64(0);
+        }
+        e.bind(referenced);
+        e.data64(1);
+        e.finish();
+        executed = 0;
+        prefix_lr = -1;
+    }
+
+    // Jump to skip unless the condition holds. EQ/NE/MI/PL read the result word directly;
+    // the rest need C or V and go through check_condition().
+    void condition(uint32_t cond, X64Emitter::Label skip) {
+        switch (cond) {
+            case 0x0: e.alu(ALU_CMP, field(&cpu.flags.z_source), 0u); e.jcc(CC_NE, skip); break;
+            case 0x1: e.alu(ALU_CMP, field(&cpu.flags.z_source), 0u); e.jcc(CC_E, skip); break;
+            case 0x4: e.alu(ALU_CMP, field(&cpu.flags.n_source), 0u); e.jcc(CC_NS, skip); break;
+            case 0x5: e.alu(ALU_CMP, field(&cpu.flags.n_source), 0u); e.jcc(CC_S, skip); break;
+            case 0xE: break;
+            case 0xF: e.jmp(skip); break;
+            default:
+                e.mov(RSI, cond);
+                call_helper(JIT_CHECK_CONDITION);
+                e.test(RAX, RAX);
+                e.jcc(CC_E, skip);
+                break;
+        }
+    }
+
+    // Fold a pending addition into carry/overflow before C is read or replaced
+    void resolve_flags() {
+        const X64Emitter::Label done = e.new_label();
+        e.cmp_byte(field(&cpu.flags.add_pending), 0);
+        e.jcc(CC_E, done);
+        call_helper(JIT_RESOLVE_FLAGS);
+        e.bind(done);
+    }
+
+    void set_nz(X64Reg result) {
+        e.store(field(&cpu.flags.n_source), result);
+        e.store(field(&cpu.flags.z_source), result);
+    }
+
+    // Carry-in for add(): 0, 1, or the C flag (flags must already be resolved)
+    static constexpr int CARRY_FLAG = -1;
+
+    // EAX = EAX + ECX + carry_in, recording the operands like LazyFlags::add()
+    void add(int carry_in, bool set_flags) {
+        if (carry_in == CARRY_FLAG) e.load_byte(RDX, field(&cpu.flags.carry));
+        if (set_flags) {
+            e.store(field(&cpu.flags.add_lhs), RAX);
+            e.store(field(&cpu.flags.add_rhs), RCX);
+            if (carry_in == CARRY_FLAG) {
+                e.store_byte(field(&cpu.flags.add_carry_in), RDX);
+            } else {
+                e.store_byte(field(&cpu.flags.add_carry_in), static_cast<uint8_t>(carry_in));
+            }
+            e.store_byte(field(&cpu.flags.add_pending), uint8_t{1});
+        }
+        e.alu(ALU_ADD, RAX, RCX);
+        if (carry_in == CARRY_FLAG) {
+            e.alu(ALU_ADD, RAX, RDX);
+        } else if (carry_in == 1) {
+            e.alu(ALU_ADD, RAX, 1u);
+        }
+        if (set_flags) set_nz(RAX);
+    }
+
+    // ARM data processing operation with operand 2 in ECX. Logical operations only set N and Z
+    // here; the caller stores any shifter carry. Carry-using operations need resolved flags.
+    void alu_operation(uint32_t opcode, bool set_flags, uint32_t rn, uint32_t rd) {
+        const bool logical = (opcode & 0x6) == 0 || (opcode & 0xC) == 0xC;
+        const bool writes_result = (opcode & 0xC) != 0x8;
+        const int carry_in = opcode >= 0x5 && opcode <= 0x7 ? CARRY_FLAG : 0;
+
+        switch (opcode) {
+            case 0x0: case 0x8: read_reg(RAX, rn); e.alu(ALU_AND, RAX, RCX); break;
+            case 0x1: case 0x9: read_reg(RAX, rn); e.alu(ALU_XOR, RAX, RCX); break;
+            case 0xC: read_reg(RAX, rn); e.alu(ALU_OR, RAX, RCX); break;
+            case 0xD: e.mov(RAX, RCX); break;
+            case 0xE: read_reg(RAX, rn); e.not_(RCX); e.alu(ALU_AND, RAX, RCX); break;
+            case 0xF: e.mov(RAX, RCX); e.not_(RAX); break;
+            case 0x2: case 0xA: read_reg(RAX, rn); e.not_(RCX); add(1, set_flags); break;
+            case 0x3: e.mov(RAX, RCX); read_reg(RCX, rn); e.not_(RCX); add(1, set_flags); break;
+            case 0x4: case 0xB: read_reg(RAX, rn); add(0, set_flags); break;
+            case 0x5: read_reg(RAX, rn); add(carry_in, set_flags); break;
+            case 0x6: read_reg(RAX, rn); e.not_(RCX); add(carry_in, set_flags); break;
+            default: e.mov(RAX, RCX); read_reg(RCX, rn); e.not_(RCX); add(carry_in, set_flags); break;
+        }
+
+        if (set_flags && logical) set_nz(RAX);
+        if (writes_result) write_reg(rd, RAX);
+    }
+
+    // Immediate barrel shift of value in place, as shift_operand<Type, true, WithCarry>.
+    // RRX reads C (resolved) through EDX.
+    void shift_immediate(X64Reg value, uint32_t type, uint32_t amount, bool with_carry) {
+        const X64Mem carry = field(&cpu.flags.carry);
+        if (type == 0) {
+            if (amount == 0) return;
+            if (with_carry) { e.bt(value, static_cast<uint8_t>(32 - amount)); e.setcc(CC_B, carry); }
+            e.shift(SHIFT_SHL, value, static_cast<uint8_t>(amount));
+        } else if (amount == 0 && type == 3) {
+            e.load_byte(RDX, carry);
+            if (with_carry) { e.bt(value, 0); e.setcc(CC_B, carry); }
+            e.shift(SHIFT_SHR, value, 1);
+            e.shift(SHIFT_SHL, RDX, 31);
+            e.alu(ALU_OR, value, RDX);
+        } else if (amount == 0) {
+            // LSR #32, ASR #32
+            if (with_carry) { e.bt(value, 31); e.setcc(CC_B, carry); }
+            if (type == 1) {
+                e.mov(value, 0u);
+            } else {
+                e.shift(SHIFT_SAR, value, 31);
+            }
+        } else {
+            if (with_carry) { e.bt(value, static_cast<uint8_t>(amount - 1)); e.setcc(CC_B, carry); }
+            const X64Shift op = type == 1 ? SHIFT_SHR : type == 2 ? SHIFT_SAR : SHIFT_ROR;
+            e.shift(op, value, static_cast<uint8_t>(amount));
+        }
+    }
+
+    // Whether an immediate shift replaces C
+    static bool shift_sets_carry(uint32_t type, uint32_t amount) {
+        return type != 0 || amount != 0;
+    }
+
+    // Load from the address in EAX into EAX. IWRAM, EWRAM and ROM are read directly;
+    // misaligned words and everything else go through GBAMemory.
+    void load(bool byte) {
+        const X64Emitter::Label slow = e.new_label();
+        const X64Emitter::Label done = e.new_label();
+        const X64Emitter::Label not_iwram = e.new_label();
+        const X64Emitter::Label not_ewram = e.new_label();
+
+        if (!byte) {
+            e.test(RAX, 3u);
+            e.jcc(CC_NE, slow);
+        }
+
+        const auto region = [&](uint32_t start, X64Mem limit, bool limit_in_memory, uint32_t size,
+                                const void* base, X64Emitter::Label next) {
+            e.mov(RCX, RAX);
+            e.alu(ALU_SUB, RCX, start);
+            if (limit_in_memory) {
+                e.load(RDX, limit);
+                e.alu(ALU_CMP, RCX, RDX);
+            } else {
+                e.alu(ALU_CMP, RCX, size);
+            }
+            e.jcc(CC_AE, next);
+            e.load64(RDX, field(base));
+            if (byte) {
+                e.load_byte(RAX, {RDX, 0, RCX, 1});
+            } else {
+                e.load(RAX, {RDX, 0, RCX, 1});
+            }
+            e.jmp(done);
+        };
+
+        region(IWRAM_START, {}, false, IWRAM_SIZE, &cpu.jit_context.iwram, not_iwram);
+        e.bind(not_iwram);
+        region(EWRAM_START, {}, false, EWRAM_SIZE, &cpu.jit_context.ewram, not_ewram);
+        e.bind(not_ewram);
+        region(ROM_START, field(&cpu.jit_context.rom_size), true, 0, &cpu.jit_context.rom, slow);
+
+        e.bind(slow);
+        e.mov(RSI, RAX);
+        call_helper(byte ? JIT_READ8 : JIT_READ32);
+        e.bind(done);
+    }
+
+    // Store EDX to the address in EAX. IWRAM and EWRAM pages without cached code are written
+    // directly (and recorded while stores are logged); everything else goes through GBAMemory,
+    // which handles I/O and invalidation.
+    void store(bool byte) {
+        const X64Emitter::Label slow = e.new_label();
+        const X64Emitter::Label done = e.new_label();
+        const X64Emitter::Label log = e.new_label();
+        const X64Emitter::Label not_iwram = e.new_label();
+
+        const auto region = [&](uint32_t start, uint32_t size, uint32_t first_page,
+                                const void* base, X64Emitter::Label next) {
+            e.mov(RCX, RAX);
+            e.alu(ALU_SUB, RCX, start);
+            e.alu(ALU_CMP, RCX, size);
+            e.jcc(CC_AE, next);
+            e.mov(RSI, RCX);
+            e.shift(SHIFT_SHR, RSI, static_cast<uint8_t>(CODE_PAGE_SHIFT));
+            if (first_page) e.alu(ALU_ADD, RSI, first_page);
+            e.load64(RDI, field(&cpu.jit_context.code_pages));
+            e.bt64({RDI, 0}, RSI);
+            e.jcc(CC_B, slow);
+            e.load64(RSI, field(base));
+            if (byte) {
+                e.store_byte({RSI, 0, RCX, 1}, RDX);
+            } else {
+                e.alu(ALU_AND, RCX, ~3u);
+                e.store({RSI, 0, RCX, 1}, RDX);
+            }
+            e.cmp_byte(field(&cpu.jit_context.log_stores), 0);
+            e.jcc(CC_NE, log);
+            e.jmp(done);
+        };
+
+        region(IWRAM_START, IWRAM_SIZE, EWRAM_CODE_PAGES, &cpu.jit_context.iwram, not_iwram);
+        e.bind(not_iwram);
+        region(EWRAM_START, EWRAM_SIZE, 0, &cpu.jit_context.ewram, slow);
+
+        e.bind(log);
+        e.mov(RSI, RAX);
+        call_helper(JIT_LOG_STORE);
+        e.jmp(done);
+
+        e.bind(slow);
+        e.mov(RSI, RAX);
+        call_helper(byte ? JIT_WRITE8 : JIT_WRITE32);
+        e.bind(done);
+    }
+
+    // Run the interpreter handler for an instruction the translator does not cover
+    void interpret(uint32_t opcode) {
+        write_back_registers();
+        e.store(physical(15), pc_value);
+        e.mov64(RDI, RBX);
+        e.load64(RSI, field(&cpu.jit_context.gba));
+        e.mov(RDX, opcode);
+        if (block.thumb) {
+            e.load64(RAX, field(&cpu.jit_context.thumb_table));
+            e.call({RAX, static_cast<int32_t>((opcode >> 6) * sizeof(void*))});
+        } else {
+            const uint32_t index = ((opcode >> 16) & 0xFF0) | ((opcode >> 4) & 0xF);
+            e.load64(RAX, field(&cpu.jit_context.arm_table));
+            e.call({RAX, static_cast<int32_t>(index * sizeof(void*))});
+        }
+
+        e.cmp_byte(field(&cpu.pipeline_flushed), 0);
+        e.jcc(CC_NE, exit_label(is_return(opcode, block.thumb) ? EXIT_RETURN : EXIT_BRANCHED));
+        const X64Emitter::Label stop = exit_label(EXIT_STOP_INTERPRETED);
+        e.cmp_byte(field(&cpu.yield_requested), 0);
+        e.jcc(CC_NE, stop);
+        e.cmp_byte(field(&cpu.code_invalidated), 0);
+        e.jcc(CC_NE, stop);
+
+        // The handler may have written any register or switched banks
+        reload_registers();
+    }
+
+    // ARM: data processing with an immediate or immediate-shifted operand, LDR/STR(B), B/BL
+    bool arm_instruction(uint32_t instruction) {
+        if ((instruction & 0x0C000000) == 0x00000000) return arm_data_processing(instruction);
+        if ((instruction & 0x0C000000) == 0x04000000) return arm_single_transfer(instruction);
+        if ((instruction & 0x0E000000) == 0x0A000000) {
+            const int32_t offset = static_cast<int32_t>(instruction << 8) >> 6;
+            if (instruction & (1 << 24)) {
+                e.mov(RAX, next_address);
+                write_reg(14, RAX);
+                push_return(next_address);
+            }
+            exit_branch(pc_value + offset);
+            return true;
+        }
+        return false;
+    }
+
+    bool arm_data_processing(uint32_t instruction) {
+        const bool immediate = (instruction & (1 << 25)) != 0;
+        const uint32_t opcode = (instruction >> 21) & 0xF;
+        const bool set_flags = (instruction & (1 << 20)) != 0;
+        const uint32_t rn = (instruction >> 16) & 0xF;
+        const uint32_t rd = (instruction >> 12) & 0xF;
+
+        // Register shifts, multiplies, swaps and halfword transfers share this space
+        if (!immediate && (instruction & 0x10)) return false;
+        // MRS/MSR
+        if ((opcode & 0xC) == 0x8 && !set_flags) return false;
+        if (rd == 15) return false;
+
+        const bool logical = (opcode & 0x6) == 0 || (opcode & 0xC) == 0xC;
+        const bool carry_in = opcode >= 0x5 && opcode <= 0x7;
+        const uint32_t shift_type = (instruction >> 5) & 3;
+        const uint32_t amount = (instruction >> 7) & 0x1F;
+        const uint32_t rotate = ((instruction >> 8) & 0xF) * 2;
+
+        const bool writes_carry = set_flags && logical &&
+                                  (immediate ? rotate != 0 : shift_sets_carry(shift_type, amount));
+        const bool rrx = !immediate && shift_type == 3 && amount == 0;
+        if (writes_carry || carry_in || rrx) resolve_flags();
+
+        if (immediate) {
+            const uint32_t value = std::rotr(instruction & 0xFF, rotate);
+            e.mov(RCX, value);
+            if (writes_carry) e.store_byte(field(&cpu.flags.carry), static_cast<uint8_t>(value >> 31));
+        } else {
+            read_reg(RCX, instruction & 0xF);
+            shift_immediate(RCX, shift_type, amount, writes_carry);
+        }
+
+        alu_operation(opcode, set_flags, rn, rd);
+        return true;
+    }
+
+    bool arm_single_transfer(uint32_t instruction) {
+        const bool register_offset = (instruction & (1 << 25)) != 0;
+        const bool pre_index = (instruction & (1 << 24)) != 0;
+        const bool up = (instruction & (1 << 23)) != 0;
+        const bool byte = (instruction & (1 << 22)) != 0;
+        const bool writeback = (instruction & (1 << 21)) != 0;
+        const bool is_load = (instruction & (1 << 20)) != 0;
+        const uint32_t rn = (instruction >> 16) & 0xF;
+        const uint32_t rd = (instruction >> 12) & 0xF;
+        const uint32_t shift_type = (instruction >> 5) & 3;
+        const uint32_t amount = (instruction >> 7) & 0x1F;
+
+        if (register_offset && (instruction & 0x10)) return false;   // Undefined
+        if (register_offset && shift_type == 3 && amount == 0) return false;  // RRX
+        if (is_load && rd == 15) return false;
+
+        // STR of R15 stores the instruction address plus 12
+        if (!is_load) {
+            if (rd == 15) {
+                e.mov(RDX, pc_value + 4);
+            } else {
+                read_reg(RDX, rd);
+            }
+        }
+
+        read_reg(RAX, rn);
+        const X64Alu direction = up ? ALU_ADD : ALU_SUB;
+        const bool writes_base = (!pre_index || writeback) && rn != 15;
+        X64Reg offset_address = RAX;
+        if (!register_offset) {
+            const uint32_t offset = instruction & 0xFFF;
+            if (pre_index) {
+                if (offset) e.alu(direction, RAX, offset);
+            } else if (writes_base) {
+                e.mov(RCX, RAX);
+                e.alu(direction, RCX, offset);
+                offset_address = RCX;
+            }
+        } else {
+            read_reg(RCX, instruction & 0xF);
+            shift_immediate(RCX, shift_type, amount, false);
+            if (pre_index) {
+                e.alu(direction, RAX, RCX);
+            } else {
+                if (!up) e.neg(RCX);
+                e.alu(ALU_ADD, RCX, RAX);
+                offset_address = RCX;
+            }
+        }
+
+        // A loaded base register wins over the writeback, so it can be written first
+        if (writes_base) write_reg(rn, offset_address);
+
+        if (is_load) {
+            load(byte);
+            write_reg(rd, RAX);
+            add_cycles(2);
+        } else {
+            store(byte);
+            add_cycles(1);
+            check_stop();
+        }
+        return true;
+    }
+
+    // Thumb formats 1-4 (except register shifts and MUL), hi register ADD/CMP/MOV, word and
+    // byte loads/stores, address generation, SP adjustment and all branches except BX
+    bool thumb_instruction(uint16_t instruction, int64_t previous_prefix) {
+        const uint32_t rd = instruction & 7;
+        const uint32_t rs = (instruction >> 3) & 7;
+
+        if ((instruction & 0xF800) == 0x1800) {
+            // ADD/SUB register or 3-bit immediate
+            const uint32_t operand = (instruction >> 6) & 7;
+            read_reg(RAX, rs);
+            if (instruction & (1 << 10)) {
+                e.mov(RCX, operand);
+            } else {
+                read_reg(RCX, operand);
+            }
+            if (instruction & (1 << 9)) {
+                e.not_(RCX);
+                add(1, true);
+            } else {
+                add(0, true);
+            }
+            write_reg(rd, RAX);
+            return true;
+        }
+
+        if ((instruction & 0xE000) == 0x0000) {
+            // Shift by immediate; LSL #0 keeps C
+            const uint32_t op = (instruction >> 11) & 3;
+            const uint32_t amount = (instruction >> 6) & 0x1F;
+            const bool writes_carry = shift_sets_carry(op, amount);
+            if (writes_carry) resolve_flags();
+            read_reg(RCX, rs);
+            shift_immediate(RCX, op, amount, writes_carry);
+            set_nz(RCX);
+            write_reg(rd, RCX);
+            return true;
+        }
+
+        if ((instruction & 0xE000) == 0x2000) {
+            // MOV/CMP/ADD/SUB with an 8-bit immediate
+            const uint32_t op = (instruction >> 11) & 3;
+            const uint32_t reg = (instruction >> 8) & 7;
+            const uint32_t immediate = instruction & 0xFF;
+            if (op == 0) {
+                e.mov(RAX, immediate);
+                set_nz(RAX);
+            } else {
+                read_reg(RAX, reg);
+                if (op == 2) {
+                    e.mov(RCX, immediate);
+                    add(0, true);
+                } else {
+                    e.mov(RCX, ~immediate);
+                    add(1, true);
+                }
+            }
+            if (op != 1) write_reg(reg, RAX);
+            return true;
+        }
+
+        if ((instruction & 0xFC00) == 0x4000) {
+            // ALU operations, mapped onto the ARM opcodes
+            static constexpr int opcodes[16] = {0x0, 0x1, -1, -1, -1, 0x5, 0x6, -1,
+                                                0x8, -1, 0xA, 0xB, 0xC, -1, 0xE, 0xF};
+            const uint32_t op = (instruction >> 6) & 0xF;
+            if (op == 0x9) {
+                // NEG
+                read_reg(RCX, rs);
+                e.mov(RAX, 0u);
+                e.not_(RCX);
+                add(1, true);
+                write_reg(rd, RAX);
+                return true;
+            }
+            if (opcodes[op] < 0) return false;
+            if (op == 0x5 || op == 0x6) resolve_flags();
+            read_reg(RCX, rs);
+            alu_operation(static_cast<uint32_t>(opcodes[op]), true, rd, rd);
+            return true;
+        }
+
+        if ((instruction & 0xFC00) == 0x4400) {
+            // Hi register ADD/CMP/MOV; anything writing R15 and BX is interpreted
+            const uint32_t op = (instruction >> 8) & 3;
+            const uint32_t hd = rd | ((instruction >> 4) & 8);
+            const uint32_t hs = (instruction >> 3) & 0xF;
+            if (op == 3 || (op != 1 && hd == 15)) return false;
+            read_reg(RCX, hs);
+            if (op == 0) {
+                read_reg(RAX, hd);
+                e.alu(ALU_ADD, RAX, RCX);
+                write_reg(hd, RAX);
+            } else if (op == 1) {
+                alu_operation(0xA, true, hd, hd);
+            } else {
+                write_reg(hd, RCX);
+            }
+            return true;
+        }
+
+        if ((instruction & 0xF800) == 0x4800) {
+            // LDR PC-relative
+            e.mov(RAX, (pc_value & ~2u) + (instruction & 0xFF) * 4);
+            load(false);
+            write_reg((instruction >> 8) & 7, RAX);
+            add_cycles(2);
+            return true;
+        }
+
+        if ((instruction & 0xF200) == 0x5000) {
+            // LDR/STR/LDRB/STRB with register offset
+            const bool is_load = (instruction & (1 << 11)) != 0;
+            const bool byte = (instruction & (1 << 10)) != 0;
+            if (!is_load) read_reg(RDX, rd);
+            read_reg(RAX, rs);
+            read_reg(RCX, (instruction >> 6) & 7);
+            e.alu(ALU_ADD, RAX, RCX);
+            thumb_transfer(is_load, byte, rd);
+            return true;
+        }
+
+        if ((instruction & 0xE000) == 0x6000) {
+            // LDR/STR/LDRB/STRB with immediate offset
+            const bool byte = (instruction & (1 << 12)) != 0;
+            const bool is_load = (instruction & (1 << 11)) != 0;
+            const uint32_t offset = (instruction >> 6) & 0x1F;
+            if (!is_load) read_reg(RDX, rd);
+            read_reg(RAX, rs);
+            if (offset) e.alu(ALU_ADD, RAX, byte ? offset : offset * 4);
+            thumb_transfer(is_load, byte, rd);
+            return true;
+        }
+
+        if ((instruction & 0xF000) == 0x9000) {
+            // SP-relative LDR/STR
+            const bool is_load = (instruction & (1 << 11)) != 0;
+            const uint32_t reg = (instruction >> 8) & 7;
+            if (!is_load) read_reg(RDX, reg);
+            read_reg(RAX, 13);
+            if (instruction & 0xFF) e.alu(ALU_ADD, RAX, (instruction & 0xFF) * 4);
+            thumb_transfer(is_load, false, reg);
+            return true;
+        }
+
+        if ((instruction & 0xF000) == 0xA000) {
+            // ADD Rd, PC/SP, #imm
+            const uint32_t offset = (instruction & 0xFF) * 4;
+            if (instruction & (1 << 11)) {
+                read_reg(RAX, 13);
+                if (offset) e.alu(ALU_ADD, RAX, offset);
+            } else {
+                e.mov(RAX, (pc_value & ~2u) + offset);
+            }
+            write_reg((instruction >> 8) & 7, RAX);
+            return true;
+        }
+
+        if ((instruction & 0xFF00) == 0xB000) {
+            // ADD SP, #+/-imm
+            read_reg(RAX, 13);
+            e.alu((instruction & 0x80) ? ALU_SUB : ALU_ADD, RAX, (instruction & 0x7F) * 4u);
+            write_reg(13, RAX);
+            return true;
+        }
+
+        if ((instruction & 0xF000) == 0xD000 && ((instruction >> 8) & 0xF) < 0xE) {
+            // Conditional branch; falling through ends the block
+            const X64Emitter::Label skip = e.new_label();
+            condition((instruction >> 8) & 0xF, skip);
+            exit_branch(pc_value + static_cast<int8_t>(instruction & 0xFF) * 2);
+            e.bind(skip);
+            return true;
+        }
+
+        if ((instruction & 0xF800) == 0xE000) {
+            exit_branch(pc_value + (static_cast<int32_t>(static_cast<uint32_t>(instruction) << 21) >> 20));
+            return true;
+        }
+
+        if ((instruction & 0xF000) == 0xF000) {
+            if (!(instruction & (1 << 11))) {
+                // BL prefix: LR = PC + (offset << 12)
+                const int32_t offset = static_cast<int32_t>(static_cast<uint32_t>(instruction) << 21) >> 9;
+                e.mov(RAX, pc_value + offset);
+                write_reg(14, RAX);
+                prefix_lr = static_cast<uint32_t>(pc_value + offset);
+                return true;
+            }
+            if (previous_prefix >= 0) {
+                // BL suffix right after its prefix: the target is known
+                const uint32_t target = static_cast<uint32_t>(previous_prefix) + (instruction & 0x7FFu) * 2;
+                e.mov(RAX, next_address | 1);
+                write_reg(14, RAX);
+                push_return(next_address);
+                exit_branch(target);
+                return true;
+            }
+            // BL suffix on its own: the target depends on LR, so it is computed at run time
+            read_reg(RDX, 14);
+            e.alu(ALU_ADD, RDX, (instruction & 0x7FFu) * 2);
+            e.mov(RAX, next_address | 1);
+            write_reg(14, RAX);
+            write_back_registers();
+            e.alu(ALU_AND, RDX, ~1u);
+            e.store(physical(15), RDX);
+            e.store_byte(field(&cpu.pipeline_flushed), uint8_t{1});
+            add_cycles(executed + 2);
+            epilogue();
+            return true;
+        }
+
+        return false;
+    }
+
+    // Thumb word/byte transfer with the address in EAX and, for stores, the value in EDX
+    void thumb_transfer(bool is_load, bool byte, uint32_t rd) {
+        if (is_load) {
+            load(byte);
+            write_reg(rd, RAX);
+            add_cycles(2);
+        } else {
+            store(byte);
+            add_cycles(1);
+            check_stop();
+        }
+    }
+};
+
+// Point the cells of freshly placed code at their targets (or their fallbacks) and register them
+// in links. translated(key) gives the chain entry of a block already translated, or nullptr.
+// Returns the keys the cells were registered under.
+template <typename Translated>
+static std::vector<uint32_t> place_cells(const JitTranslation& translation, uint8_t* base, LinkTable& links,
+                                         Translated translated) {
+    std::vector<uint32_t> targets;
+    for (const JitTranslation::Cell& cell : translation.cells) {
+        const bool return_cell = cell.unlinked == JitTranslation::RETURN_CELL;
+        const LinkSite site{reinterpret_cast<const uint8_t**>(base + cell.offset),
+                            return_cell ? nullptr : base + cell.unlinked};
+        const uint8_t* target = translated(cell.target);
+        *site.cell = target ? target : site.unlinked;
+        links.add(cell.target, site);
+        targets.push_back(cell.target);
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    return targets;
+}
+
+uint64_t JitCompiler::build_id(const ARM7CPU& cpu) {
+    // Kept code depends on what the translator emits, on the compiler that built the helpers and
+    // handlers it calls, and on where the fields it addresses sit relative to the CPU pointer
+    uint64_t hash = 0xCBF29CE484222325ull;
+    const auto mix = [&hash](const void* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 0x100000001B3ull;
+        }
+    };
+    const auto mix_offset = [&](const void* field) {
+        const uint64_t offset = static_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&cpu);
+        mix(&offset, sizeof(offset));
+    };
+
+    const uint32_t format = JIT_FORMAT_VERSION;
+    mix(&format, sizeof(format));
+    mix(__VERSION__, sizeof(__VERSION__) - 1);
+
+    mix_offset(&cpu.registers.physical);
+    mix_offset(&cpu.registers.map);
+    mix_offset(&cpu.cycles);
+    mix_offset(&cpu.thumb_mode);
+    mix_offset(&cpu.yield_requested);
+    mix_offset(&cpu.pipeline_flushed);
+    mix_offset(&cpu.code_invalidated);
+    mix_offset(&cpu.flags.n_source);
+    mix_offset(&cpu.flags.z_source);
+    mix_offset(&cpu.flags.carry);
+    mix_offset(&cpu.flags.overflow);
+    mix_offset(&cpu.flags.add_pending);
+    mix_offset(&cpu.flags.add_carry_in);
+    mix_offset(&cpu.flags.add_lhs);
+    mix_offset(&cpu.flags.add_rhs);
+
+    const JitContext& context = cpu.jit_context;
+    mix_offset(&context.iwram);
+    mix_offset(&context.ewram);
+    mix_offset(&context.rom);
+    mix_offset(&context.rom_size);
+    mix_offset(&context.code_pages);
+    mix_offset(&context.log_stores);
+    mix_offset(&context.gba);
+    mix_offset(&context.arm_table);
+    mix_offset(&context.thumb_table);
+    mix_offset(&context.helpers);
+    mix_offset(&context.chain_deadline);
+    mix_offset(&context.return_stack);
+    mix_offset(&context.return_stack[0].entry);
+    mix_offset(&context.return_stack[1]);
+    mix_offset(&context.return_top);
+    return hash;
+}
+
+JitTranslation JitCompiler::translate(ARM7CPU& cpu, const CachedBlock& block) {
+    return JitTranslator(cpu, block, true).translate();
+}
+
+NativeBlock JitCompiler::compile(ARM7CPU& cpu, const CachedBlock& block) {
+    // ROM never changes, so its translations can be shared; everything else stays private
+    if (shared && block.start >= ROM_START) {
+        if (NativeBlock code = compile_shared(cpu, block)) return code;
+    }
+    return install(cpu, block, translate(cpu, block));
+}
+
+NativeBlock JitCompiler::install(ARM7CPU& cpu, const CachedBlock& block, const JitTranslation& translation) {
+    // Entry points stay 16-byte aligned
+    const uint32_t size = (static_cast<uint32_t>(translation.code.size()) + 15) & ~15u;
+    uint8_t* base = cache.allocate(size, [&](const CodeCache::Resident& resident) { evict(cpu, resident); });
+    if (!base) return nullptr;
+    std::memcpy(base, translation.code.data(), translation.code.size());
+    entry_offset = translation.entry_offset;
+
+    std::vector<uint32_t> targets = place_cells(translation, base, links, [&](uint32_t target) -> const uint8_t* {
+        const CachedBlock* translated = cpu.block_cache.find(target & ~1u, target & 1);
+        return translated && translated->native && cpu.translatable(*translated) ? entry(translated->native) : nullptr;
+    });
+    cache.insert({key(block), base, size, base + translation.referenced, std::move(targets)});
+    return reinterpret_cast<NativeBlock>(base);
+}
+
+NativeBlock JitCompiler::compile_shared(ARM7CPU& cpu, const CachedBlock& block) {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    auto it = shared->blocks.find(key(block));
+    if (it != shared->blocks.end()) {
+        shared_hits++;
+        entry_offset = shared->entry_offset;
+        return reinterpret_cast<NativeBlock>(const_cast<uint8_t*>(it->second));
+    }
+
+    // Shared code is never evicted, so it does not track references
+    const JitTranslation translation = JitTranslator(cpu, block, false).translate();
+    uint8_t* base = shared->append(translation.code.data(), translation.code.size());
+    if (!base) return nullptr;
+    entry_offset = shared->entry_offset = translation.entry_offset;
+
+    // Shared code only links to shared code, so another instance's evictions never reach it.
+    // Every instance sharing it has the same idle loops (SharedCodeCache::for_rom()).
+    place_cells(translation, base, shared->links, [&](uint32_t target) -> const uint8_t* {
+        if (cpu.idle_loop_addresses.contains(target & ~1u)) return nullptr;
+        auto translated = shared->blocks.find(target);
+        return translated != shared->blocks.end() ? translated->second + entry_offset : nullptr;
+    });
+    shared->blocks[key(block)] = base;
+    shared->links.link(key(block), base + entry_offset);
+    return reinterpret_cast<NativeBlock>(base);
+}
+
+void JitCompiler::evict(ARM7CPU& cpu, const CodeCache::Resident& resident) {
+    // The block may already have been dropped, or retranslated elsewhere after an invalidation
+    CachedBlock* block = cpu.block_cache.find(resident.key & ~1u, resident.key & 1);
+    if (block && block->native == reinterpret_cast<NativeBlock>(resident.code)) {
+        unlink(*block);
+        block->native = nullptr;
+    }
+
+    const uint8_t* end = resident.code + resident.size;
+    for (uint32_t target : resident.targets) links.remove(target, resident.code, end);
+    for (JitContext::ReturnEntry& entry : cpu.jit_context.return_stack) {
+        const uint8_t* cell = reinterpret_cast<const uint8_t*>(entry.entry);
+        if (cell >= resident.code && cell < end) entry = {};
+    }
+    evictions++;
+}
+
+void JitCompiler::reset(JitContext& context) {
+    cache.clear();
+    links.clear();
+    shared.reset();
+    // The stack's cells lived in the cache
+    context.return_stack.fill({});
+    context.return_top = 0;
+}
+
+JitCacheStats JitCompiler::stats() const {
+    JitCacheStats result;
+    result.hits = hits;
+    result.misses = misses;
+    result.shared_hits = shared_hits;
+    result.evictions = evictions;
+    result.bytes_used = cache.used();
+    result.bytes_budget = cache.budget();
+    return result;
+}
+
+#endif
+
+bool ARM7CPU::prepare_jit(GBASystem& gba) {
+#ifdef JIT_X64
+    if (!jit) jit = std::make_unique<JitCompiler>(jit_cache_budget);
+    if (!jit->available()) return false;
+    if (jit_share_rom_code && !jit->shared) {
+        jit->shared = SharedCodeCache::for_rom(gba.memory.rom_hash(), idle_loop_addresses, JIT_SHARED_CACHE_SIZE);
+    }
+    JitCompiler::bind(*this, gba);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ARM7CPU::execute_native(CachedBlock& block) {
+#ifdef JIT_X64
+    if (!translatable(block)) return false;
+    jit->count_dispatch(block.native != nullptr);
+    if (!block.native) {
+        // Only a block larger than the whole budget fails here; it stays interpreted
+        block.native = jit->compile(*this, block);
+        if (!block.native) return false;
+        jit->link(block);
+    }
+    pipeline_flushed = false;
+    block.native(this);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ARM7CPU::unlink_native(uint32_t address) {
+#ifdef JIT_X64
+    if (!jit) return;
+    block_cache.for_each_in_page(address, [this](const CachedBlock& block) {
+        if (block.native) jit->unlink(block);
+    });
+#endif
+}
+
+JitCacheStats ARM7CPU::jit_stats() const {
+#ifdef JIT_X64
+    if (jit) return jit->stats();
+#endif
+    return {};
+}
+
+void ARM7CPU::reset_native() {
+#ifdef JIT_X64
+    if (jit) jit->reset(jit_context);
+#endif
+}
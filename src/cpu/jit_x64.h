@@ -0,0 +1,153 @@
+// cpu/jit_x64.h
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "block_cache.h"
+#include "jit_code_cache.h"
+
+// The native backend needs an x86-64 host with mmap; elsewhere ExecutionMode::JIT
+// runs the block cache instead
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_X64
+#endif
+
+// Forward declarations
+class ARM7CPU;
+class GBASystem;
+
+// Default byte budget for one instance's translated code
+constexpr size_t JIT_BUFFER_SIZE = 4 << 20;
+
+// Size of a cross-instance cache for one ROM's code
+constexpr size_t JIT_SHARED_CACHE_SIZE = 16 << 20;
+
+// Version of the code the translator emits. Bump it whenever the emitter or the translator
+// changes, so translations kept in code cache files by an older build are not installed.
+constexpr uint32_t JIT_FORMAT_VERSION = 2;
+
+// Runtime entry points that translated code calls through JitContext::helpers
+enum JitHelper {
+    JIT_READ32,             // Rotated word load (memory slow path)
+    JIT_READ8,
+    JIT_WRITE32,
+    JIT_WRITE8,
+    JIT_LOG_STORE,          // Record a direct RAM store in GBAMemory::write_log
+    JIT_CHECK_CONDITION,    // Conditions that need C or V
+    JIT_RESOLVE_FLAGS,      // Fold a pending addition into C and V
+    JIT_HELPER_COUNT
+};
+
+// Entries in the return-address stack (a power of two)
+constexpr uint32_t RETURN_STACK_SIZE = 8;
+
+// Everything translated code needs apart from the CPU itself. It lives inside ARM7CPU and is
+// addressed relative to the CPU pointer, so translated code holds no absolute addresses.
+struct JitContext {
+    uint8_t* iwram = nullptr;
+    uint8_t* ewram = nullptr;
+    const uint8_t* rom = nullptr;
+    uint32_t rom_size = 0;                  // Whole words only
+    const uint64_t* code_pages = nullptr;   // GBAMemory::code_pages
+    bool log_stores = false;                // GBAMemory::write_log is set
+    GBASystem* gba = nullptr;
+    const void* arm_table = nullptr;        // Interpreter handlers for untranslated instructions
+    const void* thumb_table = nullptr;
+    std::array<const void*, JIT_HELPER_COUNT> helpers{};
+
+    // Blocks jump straight into the next translated block while cycles is below this
+    uint64_t chain_deadline = 0;
+
+    static constexpr const uint8_t* NO_RETURN = nullptr;   // Cell of empty entries
+
+    // Return-address stack pushed by translated BLs. entry points at a cell that holds the
+    // return block's chain entry while that block is translated, and nullptr otherwise.
+    struct ReturnEntry {
+        uint32_t key = 0;
+        const uint8_t* const* entry = &NO_RETURN;
+    };
+    std::array<ReturnEntry, RETURN_STACK_SIZE> return_stack{};
+    uint32_t return_top = 0;
+};
+
+// A block's translated code before it is placed, with the offsets of the cells to fill in.
+// The code itself holds no absolute addresses, so it can be kept and placed later.
+struct JitTranslation {
+    static constexpr uint32_t RETURN_CELL = ~0u;
+
+    struct Cell {
+        uint32_t offset;
+        uint32_t unlinked;      // Fallback path of an exit cell, or RETURN_CELL
+        uint32_t target;        // Block key
+    };
+
+    std::vector<uint8_t> code;
+    uint32_t entry_offset = 0;  // Chain entry
+    uint32_t referenced = 0;    // Byte set on every entry
+    std::vector<Cell> cells;
+};
+
+// Translates cached blocks into x86-64 code and manages where that code lives
+class JitCompiler {
+public:
+    explicit JitCompiler(size_t budget = JIT_BUFFER_SIZE) : cache(budget) {}
+
+    bool available() const { return cache.valid(); }
+
+    // Optional cross-instance cache for ROM code
+    std::shared_ptr<SharedCodeCache> shared;
+
+    // Point cpu.jit_context at this system's memory and the runtime helpers
+    static void bind(ARM7CPU& cpu, GBASystem& gba);
+
+    // Translate a block, evicting older translations if the budget requires it; nullptr if
+    // it cannot be placed. Exits towards blocks that are already translated are linked to them.
+    NativeBlock compile(ARM7CPU& cpu, const CachedBlock& block);
+
+    // The two halves of a private compile(), for translations kept across runs
+    static JitTranslation translate(ARM7CPU& cpu, const CachedBlock& block);
+    NativeBlock install(ARM7CPU& cpu, const CachedBlock& block, const JitTranslation& translation);
+
+    // Identifies the code this build generates for cpu: JIT_FORMAT_VERSION, the compiler version
+    // and the offsets of the CPU fields translated code addresses. Kept translations with another
+    // id are unusable.
+    static uint64_t build_id(const ARM7CPU& cpu);
+
+    // Point every exit and return cell that targets block at its code; unlink() reverts them
+    // to the dispatcher before the block is dropped
+    void link(const CachedBlock& block) { links.link(key(block), entry(block.native)); }
+    void unlink(const CachedBlock& block) { links.unlink(key(block)); }
+
+    // Drop all private translations and links, and the shared cache
+    void reset(JitContext& context);
+
+    JitCacheStats stats() const;
+    void count_dispatch(bool hit) { (hit ? hits : misses)++; }
+
+private:
+    CodeCache cache;
+    LinkTable links;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t shared_hits = 0;
+    uint64_t evictions = 0;
+
+    uint32_t entry_offset = 0;  // Chain entry, past the prologue; the same for every block
+
+    static uint32_t key(const CachedBlock& block) { return block.start | static_cast<uint32_t>(block.thumb); }
+    const uint8_t* entry(NativeBlock code) const { return reinterpret_cast<const uint8_t*>(code) + entry_offset; }
+
+    NativeBlock compile_shared(ARM7CPU& cpu, const CachedBlock& block);
+    void evict(ARM7CPU& cpu, const CodeCache::Resident& resident);
+
+    static uint32_t read32(ARM7CPU* cpu, uint32_t address);
+    static uint32_t read8(ARM7CPU* cpu, uint32_t address);
+    static void write32(ARM7CPU* cpu, uint32_t address, uint32_t value);
+    static void write8(ARM7CPU* cpu, uint32_t address, uint32_t value);
+    static void log_store(ARM7CPU* cpu, uint32_t address);
+    static uint32_t check_condition(ARM7CPU* cpu, uint32_t condition);
+    static void resolve_flags(ARM7CPU* cpu);
+};
@@ -0,0 +1,292 @@
+// cpu/rom_predecoder.cpp
+#include "rom_predecoder.h"
+#include "arm7_cpu.h"
+#include "../system.h"
+#include <array>
+#include <bit>
+#include <cstring>
+#include <iostream>
+
+// Where the BIOS interrupt dispatcher looks for the game's IRQ handler (called in ARM state)
+constexpr uint32_t IRQ_HANDLER_POINTER = 0x03007FFC;
+
+// Values a block's instructions are known to leave in registers, tracked in program order.
+// Only constants loaded from literal pools, immediates and PC-relative addresses are followed;
+// anything else that may write a register forgets it.
+struct KnownRegisters {
+    std::array<uint32_t, 16> value{};
+    uint32_t mask = 0;
+
+    bool has(uint32_t reg) const { return (mask >> reg) & 1; }
+    void set(uint32_t reg, uint32_t v) { value[reg] = v; mask |= 1u << reg; }
+    void forget(uint32_t reg) { mask &= ~(1u << reg); }
+};
+
+RomPredecoder::RomPredecoder(const std::vector<uint8_t>& rom, ARM7CPU& cpu, bool translate)
+    : rom(rom.data()), rom_size(static_cast<uint32_t>(rom.size()) & ~3u), cpu(cpu), translate(translate) {
+    worker = std::thread(&RomPredecoder::run, this);
+}
+
+RomPredecoder::~RomPredecoder() {
+    cancel.store(true, std::memory_order_relaxed);
+    worker.join();
+}
+
+std::vector<RomPredecoder::Result> RomPredecoder::take() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.store(false, std::memory_order_relaxed);
+    return std::move(results);
+}
+
+void RomPredecoder::run() {
+    // Breadth first, so the code nearest the entry point is ready first
+    push(ROM_START, false);
+    std::vector<Result> batch;
+    auto publish = [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Result& ready : batch) results.push_back(std::move(ready));
+        batch.clear();
+        pending.store(true, std::memory_order_release);
+    };
+
+    for (size_t next = 0; next < worklist.size() && !cancel.load(std::memory_order_relaxed); next++) {
+        const Target target = worklist[next];
+        Result result;
+        if (!ARM7CPU::decode_block(rom, ROM_START, rom_size, target.address, target.thumb, result.block)) continue;
+        if (target.thumb) {
+            follow_thumb(result.block);
+        } else {
+            follow_arm(result.block);
+        }
+#ifdef JIT_X64
+        if (translate && !result.block.idle_loop) result.translation = JitCompiler::translate(cpu, result.block);
+#endif
+        batch.push_back(std::move(result));
+        if (batch.size() >= 64) publish();
+    }
+    if (!batch.empty()) publish();
+
+    #ifdef DEBUG_PREDECODE
+    std::cout << "Predecode: " << worklist.size() << " blocks reachable from the ROM entry point" << std::endl;
+    #endif
+
+    done.store(true, std::memory_order_release);
+}
+
+void RomPredecoder::push(uint32_t address, bool thumb) {
+    if (address - ROM_START >= rom_size || (address & (thumb ? 1 : 3)) != 0) return;
+    if (visited.size() >= PREDECODE_BLOCK_LIMIT) return;
+    if (visited.insert(address | static_cast<uint32_t>(thumb)).second) {
+        worklist.push_back({address, thumb});
+    }
+}
+
+bool RomPredecoder::read_word(uint32_t address, uint32_t& value) const {
+    const uint32_t offset = address - ROM_START;
+    if (offset >= rom_size || offset + 4 > rom_size || (offset & 3) != 0) return false;
+    std::memcpy(&value, rom + offset, 4);
+    return true;
+}
+
+void RomPredecoder::follow_arm(const CachedBlock& block) {
+    KnownRegisters known;
+    uint32_t return_address = 0;    // Left in LR by the instruction before, for register calls
+    uint32_t address = block.start;
+
+    for (size_t n = 0; n < block.ops.size(); n++, address += 4) {
+        const uint32_t i = block.ops[n].opcode;
+        const uint32_t rd = (i >> 12) & 0xF;
+        const uint32_t rn = (i >> 16) & 0xF;
+        const uint32_t rm = i & 0xF;
+        const uint32_t pc = address + 8;
+        const uint32_t rotated = std::rotr(i & 0xFF, static_cast<int>((i >> 8) & 0xF) * 2);
+        const uint32_t call_return = return_address;
+        return_address = 0;
+
+        uint32_t literal = 0;
+        bool literal_load = false;
+        if ((i & 0x0F7F0000) == 0x051F0000) {
+            // LDR Rd, [PC, #offset]
+            const uint32_t offset = i & 0xFFF;
+            literal_load = read_word((i & (1u << 23)) ? pc + offset : pc - offset, literal);
+            if (literal_load && rd != 15) {
+                known.set(rd, literal);
+            } else {
+                known.forget(rd);
+            }
+        } else if ((i & 0x0FEF0000) == 0x03A00000) {
+            // MOV Rd, #imm
+            known.set(rd, rotated);
+        } else if ((i & 0x0FFF0000) == 0x028F0000) {
+            // ADD Rd, PC, #imm
+            known.set(rd, pc + rotated);
+            if (rd == 14) return_address = pc + rotated;
+        } else if ((i & 0x0FFFFFFF) == 0x01A0E00F) {
+            // MOV LR, PC
+            known.set(14, pc);
+            return_address = pc;
+        } else if ((i & 0x0E500000) == 0x04000000) {
+            // STR Rd, [Rn, #offset]: installing an IRQ handler
+            const uint32_t offset = i & 0xFFF;
+            const uint32_t target = (i & (1u << 23)) ? known.value[rn] + offset : known.value[rn] - offset;
+            if (known.has(rn) && known.has(rd) && (i & (1u << 24)) && target == IRQ_HANDLER_POINTER) {
+                push(known.value[rd] & ~3u, false);
+            }
+            if ((i & (1u << 21)) || !(i & (1u << 24))) known.forget(rn);
+        } else {
+            known.forget(rd);
+            known.forget(rn);
+            if ((i & 0x0E100000) == 0x08100000) known.mask &= ~(i & 0xFFFF);  // LDM
+            if ((i & 0x0F000000) == 0x0B000000) known.forget(14);             // BL
+        }
+
+        if (n + 1 != block.ops.size()) continue;
+
+        // Successors of the instruction that ended the block
+        const uint32_t next = address + 4;
+        bool falls_through = (i >> 28) != 0xE;
+        if ((i & 0x0E000000) == 0x0A000000) {
+            // B, BL
+            push(pc + (static_cast<int32_t>(i << 8) >> 6), false);
+            if (i & (1u << 24)) falls_through = true;
+        } else if ((i & 0x0FFFFFF0) == 0x012FFF10) {
+            // BX Rm
+            if (known.has(rm)) push(known.value[rm] & ~1u, known.value[rm] & 1);
+            if (call_return) push(call_return, false);
+        } else if ((i & 0x0FFFFFF0) == 0x01A0F000) {
+            // MOV PC, Rm
+            if (known.has(rm)) push(known.value[rm] & ~3u, false);
+            if (call_return) push(call_return, false);
+        } else if (literal_load && rd == 15) {
+            // LDR PC, =target
+            push(literal & ~3u, false);
+            if (call_return) push(call_return, false);
+        } else if ((i & 0x0F000000) == 0x0F000000) {
+            // SWI returns to the next instruction
+            falls_through = true;
+        } else if ((i & 0x0DB0F000) == 0x0120F000 || (i & 0x0D90F000) == 0x0110F000) {
+            // MSR and TST/TEQ/CMP/CMN have all ones where Rd would be, but never write PC
+            falls_through = true;
+        } else if ((next & ((1u << CODE_PAGE_SHIFT) - 1)) == 0) {
+            // Cut at a page boundary rather than ended by a branch
+            falls_through = true;
+        }
+        if (falls_through) push(next, false);
+    }
+}
+
+void RomPredecoder::follow_thumb(const CachedBlock& block) {
+    KnownRegisters known;
+    uint32_t return_address = 0;
+    uint32_t address = block.start;
+
+    for (size_t n = 0; n < block.ops.size(); n++, address += 2) {
+        const uint32_t i = block.ops[n].opcode;
+        const uint32_t pc = address + 4;
+        const uint32_t literal_base = pc & ~2u;
+        const uint32_t high_rd = (i & 7) | ((i >> 4) & 8);
+        const uint32_t high_rm = (i >> 3) & 0xF;
+        const uint32_t call_return = return_address;
+        return_address = 0;
+
+        if ((i & 0xF800) == 0x4800) {
+            // LDR Rd, [PC, #imm]
+            uint32_t literal;
+            if (read_word(literal_base + (i & 0xFF) * 4, literal)) {
+                known.set((i >> 8) & 7, literal);
+            } else {
+                known.forget((i >> 8) & 7);
+            }
+        } else if ((i & 0xF800) == 0x2000) {
+            // MOV Rd, #imm
+            known.set((i >> 8) & 7, i & 0xFF);
+        } else if ((i & 0xF800) == 0xA000) {
+            // ADD Rd, PC, #imm
+            known.set((i >> 8) & 7, literal_base + (i & 0xFF) * 4);
+        } else if (i == 0x46FE) {
+            // MOV LR, PC
+            known.set(14, pc);
+            return_address = pc;
+        } else if ((i & 0xFF00) == 0x4600) {
+            // MOV Rd, Rm (high registers)
+            if (known.has(high_rm) && high_rm != 15) {
+                known.set(high_rd, known.value[high_rm]);
+            } else {
+                known.forget(high_rd);
+            }
+        } else if ((i & 0xF800) == 0x6000) {
+            // STR Rd, [Rb, #imm]: installing an IRQ handler
+            const uint32_t rd = i & 7;
+            const uint32_t rb = (i >> 3) & 7;
+            if (known.has(rb) && known.has(rd) && known.value[rb] + ((i >> 6) & 0x1F) * 4 == IRQ_HANDLER_POINTER) {
+                push(known.value[rd] & ~3u, false);
+            }
+        } else if ((i & 0xFE00) == 0xBC00 || (i & 0xF800) == 0xC800) {
+            // POP, LDMIA
+            known.mask &= ~0xFFu;
+        } else {
+            known.forget(i & 7);
+            known.forget((i >> 8) & 7);
+            if ((i & 0xFC00) == 0x4400) known.forget(high_rd);
+            if ((i & 0xF000) == 0xF000) known.forget(14);   // BL
+        }
+
+        if (n + 1 != block.ops.size()) continue;
+
+        const uint32_t next = address + 2;
+        if ((i & 0xF000) == 0xD000) {
+            // Conditional branch; SWI (condition 0xF) returns to the next instruction
+            const uint32_t condition = (i >> 8) & 0xF;
+            if (condition < 0xE) push(pc + (static_cast<int32_t>(i << 24) >> 23), true);
+            if (condition != 0xE) push(next, true);
+        } else if ((i & 0xF800) == 0xE000) {
+            // B
+            push(pc + (static_cast<int32_t>(i << 21) >> 20), true);
+        } else if ((i & 0xF800) == 0xF800) {
+            // BL, when its first half is in the same block
+            const uint32_t prefix = n > 0 ? block.ops[n - 1].opcode : 0;
+            if ((prefix & 0xF800) == 0xF000) {
+                push(pc - 2 + (static_cast<int32_t>(prefix << 21) >> 9) + ((i & 0x7FF) << 1), true);
+            }
+            push(next, true);
+        } else if ((i & 0xFF87) == 0x4700) {
+            // BX Rm
+            if (known.has(high_rm)) push(known.value[high_rm] & ~1u, known.value[high_rm] & 1);
+            if (call_return) push(call_return, true);
+        } else if ((i & 0xFF87) == 0x4687) {
+            // MOV PC, Rm
+            if (known.has(high_rm)) push(known.value[high_rm] & ~1u, true);
+            if (call_return) push(call_return, true);
+        } else if ((next & ((1u << CODE_PAGE_SHIFT) - 1)) == 0) {
+            push(next, true);
+        }
+    }
+}
+
+void ARM7CPU::start_predecode(GBASystem& gba) {
+    stop_predecode();
+    if (gba.memory.rom.empty()) return;
+    predecoder = std::make_unique<RomPredecoder>(gba.memory.rom, *this, execution_mode == ExecutionMode::JIT);
+}
+
+void ARM7CPU::stop_predecode() {
+    predecoder.reset();
+}
+
+void ARM7CPU::merge_predecoded([[maybe_unused]] bool native) {
+    // Read before taking, so everything published before the worker finished is included
+    const bool finished = predecoder->finished();
+    if (predecoder->has_results()) {
+        for (RomPredecoder::Result& result : predecoder->take()) {
+            if (block_cache.find(result.block.start, result.block.thumb)) continue;
+            CachedBlock& block = block_cache.insert(std::move(result.block));
+#ifdef JIT_X64
+            if (native && !result.translation.code.empty() && translatable(block)) {
+                block.native = jit->install(*this, block, result.translation);
+                if (block.native) jit->link(block);
+            }
+#endif
+        }
+    }
+    if (finished) predecoder.reset();
+}
@@ -0,0 +1,69 @@
+// cpu/rom_predecoder.h
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "block_cache.h"
+#include "jit_x64.h"
+
+// Forward declarations
+class ARM7CPU;
+
+// Upper bound on the blocks one ROM walk decodes
+constexpr uint32_t PREDECODE_BLOCK_LIMIT = 1 << 16;
+
+// Walks the code reachable from the ROM entry point on a worker thread and decodes it ahead of
+// execution. Branch and call targets are followed, as are code pointers loaded from literal
+// pools into BX/MOV PC and IRQ handler addresses stored to 0x03007FFC. ROM never changes, so
+// nothing found here can go stale.
+class RomPredecoder {
+public:
+    // A decoded block and, when translating, its translation
+    struct Result {
+        CachedBlock block;
+        JitTranslation translation;
+    };
+
+    // rom must stay alive and unchanged until the predecoder is destroyed. cpu is only used for
+    // the layout translated code addresses; none of its state is read.
+    RomPredecoder(const std::vector<uint8_t>& rom, ARM7CPU& cpu, bool translate);
+    ~RomPredecoder();
+    RomPredecoder(const RomPredecoder&) = delete;
+    RomPredecoder& operator=(const RomPredecoder&) = delete;
+
+    // Blocks found since the last call
+    std::vector<Result> take();
+    bool has_results() const { return pending.load(std::memory_order_acquire); }
+    bool finished() const { return done.load(std::memory_order_acquire); }
+
+private:
+    struct Target {
+        uint32_t address;
+        bool thumb;
+    };
+
+    const uint8_t* rom;
+    uint32_t rom_size;          // Whole words only, as GBAMemory::code_region() gives it
+    ARM7CPU& cpu;
+    const bool translate;
+
+    std::vector<Target> worklist;
+    std::unordered_set<uint32_t> visited;   // Block keys
+
+    std::mutex mutex;                       // Guards results
+    std::vector<Result> results;
+    std::atomic<bool> pending{false};
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> done{false};
+    std::thread worker;
+
+    void run();
+    void push(uint32_t address, bool thumb);
+    bool read_word(uint32_t address, uint32_t& value) const;
+    void follow_arm(const CachedBlock& block);
+    void follow_thumb(const CachedBlock& block);
+};
@@ -0,0 +1,142 @@
+// cpu/threaded_interpreter.cpp
+#include "arm_instructions.h"
+#include "thumb_instructions.h"
+
+#ifdef THREADED_INTERPRETER
+
+#if !defined(__GNUC__) && !defined(__clang__)
+#error "THREADED_INTERPRETER needs labels-as-values (GCC or Clang)"
+#endif
+
+#ifdef DEBUG_TRACE
+#define TRACE_INSTRUCTION() \
+    trace.record(registers[15] - (thumb_mode ? 4 : 8), instruction, get_cpsr(), static_cast<uint32_t>(cycles))
+#else
+#define TRACE_INSTRUCTION() ((void)0)
+#endif
+
+#define ARM_INDEX(instruction) ((((instruction) >> 16) & 0xFF0) | (((instruction) >> 4) & 0xF))
+
+// Advance the pipeline after an instruction and jump straight to the next one's handler.
+// Every handler label expands its own copy, so each gets a separate indirect branch.
+#define DISPATCH()                                                            \
+    do {                                                                      \
+        if (pipeline_flushed) goto branched;                                  \
+        pipeline[0] = pipeline[1];                                            \
+        if (thumb_mode) {                                                     \
+            pipeline[1] = fetch16(gba, registers[15]);                        \
+            registers[15] += 2;                                               \
+        } else {                                                              \
+            pipeline[1] = fetch32(gba, registers[15]);                        \
+            registers[15] += 4;                                               \
+        }                                                                     \
+        cycles++;                                                             \
+        if (cycles >= deadline || yield_requested) goto done;                 \
+        if (irq_line && !(cpsr & FLAG_I)) goto interrupt;                     \
+        instruction = pipeline[0];                                            \
+        TRACE_INSTRUCTION();                                                  \
+        if (thumb_mode) goto *thumb_labels[instruction >> 6];                 \
+        if ((instruction >> 28) != CONDITION_ALWAYS &&                        \
+            !check_condition(instruction >> 28)) goto arm_skipped;            \
+        goto *arm_labels[arm_ids[ARM_INDEX(instruction)]];                    \
+    } while (0)
+
+// Handler numbers are spelled as three hex digits, so one macro argument list can both name a
+// label and give the number it handles
+#define HANDLERS_16(M, a, b)                                                  \
+    M(a, b, 0) M(a, b, 1) M(a, b, 2) M(a, b, 3) M(a, b, 4) M(a, b, 5) M(a, b, 6) M(a, b, 7) \
+    M(a, b, 8) M(a, b, 9) M(a, b, A) M(a, b, B) M(a, b, C) M(a, b, D) M(a, b, E) M(a, b, F)
+#define HANDLERS_256(M, a)                                                    \
+    HANDLERS_16(M, a, 0) HANDLERS_16(M, a, 1) HANDLERS_16(M, a, 2) HANDLERS_16(M, a, 3) \
+    HANDLERS_16(M, a, 4) HANDLERS_16(M, a, 5) HANDLERS_16(M, a, 6) HANDLERS_16(M, a, 7) \
+    HANDLERS_16(M, a, 8) HANDLERS_16(M, a, 9) HANDLERS_16(M, a, A) HANDLERS_16(M, a, B) \
+    HANDLERS_16(M, a, C) HANDLERS_16(M, a, D) HANDLERS_16(M, a, E) HANDLERS_16(M, a, F)
+
+// ARM handler numbers 0x000-0x12B (arm_instructions.h), Thumb table indices 0x000-0x3FF
+#define ARM_HANDLERS(M)                                                       \
+    HANDLERS_256(M, 0) HANDLERS_16(M, 1, 0) HANDLERS_16(M, 1, 1)              \
+    M(1, 2, 0) M(1, 2, 1) M(1, 2, 2) M(1, 2, 3) M(1, 2, 4) M(1, 2, 5)         \
+    M(1, 2, 6) M(1, 2, 7) M(1, 2, 8) M(1, 2, 9) M(1, 2, A) M(1, 2, B)
+#define THUMB_HANDLERS(M) HANDLERS_256(M, 0) HANDLERS_256(M, 1) HANDLERS_256(M, 2) HANDLERS_256(M, 3)
+
+static_assert(ARM_HANDLER_COUNT == 0x12C, "ARM_HANDLERS must list every ARM handler number");
+
+#define ARM_LABEL_ADDRESS(a, b, c) &&arm_##a##b##c,
+#define THUMB_LABEL_ADDRESS(a, b, c) &&thumb_##a##b##c,
+
+// Each handler (each specialization, for the templated ones) is called directly from its own
+// label, so the dispatch that follows is the only indirect branch per instruction
+#define ARM_HANDLER_LABEL(a, b, c)                                            \
+    arm_##a##b##c:                                                            \
+    arm_handler<0x##a##b##c>()(*this, gba, instruction);                      \
+    DISPATCH();
+#define THUMB_HANDLER_LABEL(a, b, c)                                          \
+    thumb_##a##b##c:                                                          \
+    decode_thumb<0x##a##b##c>()(*this, gba, static_cast<uint16_t>(instruction)); \
+    DISPATCH();
+
+int ARM7CPU::run_interpreter(GBASystem& gba, int budget) {
+    // ARM opcodes go through their handler number, Thumb opcodes straight to their table index
+    static constexpr std::array<uint16_t, 4096> arm_ids = [] {
+        std::array<uint16_t, 4096> ids{};
+        for (uint32_t index = 0; index < ids.size(); index++) {
+            ids[index] = static_cast<uint16_t>(arm_handler_id(index));
+        }
+        return ids;
+    }();
+    static void* const arm_labels[ARM_HANDLER_COUNT] = {ARM_HANDLERS(ARM_LABEL_ADDRESS)};
+    static void* const thumb_labels[1024] = {THUMB_HANDLERS(THUMB_LABEL_ADDRESS)};
+
+    const uint64_t start = cycles;
+    const uint64_t deadline = cycles + budget;
+    const bool irq_line = gba.has_pending_interrupts();
+    uint32_t instruction;
+
+    yield_requested = false;
+    if (budget <= 0) return 0;
+    goto dispatch;
+
+branched:
+    // A taken branch or exception left the target in R15; refill before decoding
+    cycles++;
+    if (cycles >= deadline || yield_requested) goto done;
+
+dispatch:
+    if (pipeline_flushed) {
+        if (!idle_loop_addresses.empty() && skip_configured_idle_loop(registers[15], deadline)) goto done;
+        refill_pipeline(gba);
+    }
+    if (irq_line && !(cpsr & FLAG_I)) goto interrupt;
+    instruction = pipeline[0];
+    TRACE_INSTRUCTION();
+    if (thumb_mode) goto *thumb_labels[instruction >> 6];
+    if ((instruction >> 28) != CONDITION_ALWAYS && !check_condition(instruction >> 28)) goto arm_skipped;
+    goto *arm_labels[arm_ids[ARM_INDEX(instruction)]];
+
+interrupt:
+    // Return after taking an IRQ so the caller can reschedule
+    handle_irq(gba);
+
+done:
+    return static_cast<int>(cycles - start);
+
+arm_skipped:
+    DISPATCH();
+
+    ARM_HANDLERS(ARM_HANDLER_LABEL)
+    THUMB_HANDLERS(THUMB_HANDLER_LABEL)
+}
+
+#undef THUMB_HANDLER_LABEL
+#undef ARM_HANDLER_LABEL
+#undef THUMB_LABEL_ADDRESS
+#undef ARM_LABEL_ADDRESS
+#undef THUMB_HANDLERS
+#undef ARM_HANDLERS
+#undef HANDLERS_256
+#undef HANDLERS_16
+#undef DISPATCH
+#undef ARM_INDEX
+#undef TRACE_INSTRUCTION
+
+#endif
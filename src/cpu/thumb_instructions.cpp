@@ -0,0 +1,22 @@
+// cpu/thumb_instructions.cpp
+#include "thumb_instructions.h"
+#include <utility>
+
+void ARM7CPU::thumb_software_interrupt(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    if (cpu.hle_bios && cpu.hle_swi(gba, instruction & 0xFF)) return;
+    cpu.enter_exception(CpuMode::SUPERVISOR, VECTOR_SWI, cpu.next_instruction_address());
+}
+
+void ARM7CPU::thumb_branch(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const int32_t offset = static_cast<int32_t>(static_cast<uint32_t>(instruction) << 21) >> 20;
+    cpu.branch_to(cpu.registers[15] + offset);
+}
+
+void ARM7CPU::thumb_undefined(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    cpu.enter_exception(CpuMode::UNDEFINED, VECTOR_UNDEFINED, cpu.next_instruction_address());
+}
+
+constinit const std::array<ARM7CPU::ThumbHandler, 1024> ARM7CPU::thumb_table =
+    []<size_t... Index>(std::index_sequence<Index...>) {
+        return std::array<ThumbHandler, 1024>{decode_thumb<Index>()...};
+    }(std::make_index_sequence<1024>{});
@@ -0,0 +1,465 @@
+// cpu/thumb_instructions.h
+#pragma once
+
+#include "arm7_cpu.h"
+#include "alu.h"
+#include "../system.h"
+#include <bit>
+
+// Thumb handler templates and decode_thumb(), shared by thumb_table (thumb_instructions.cpp) and
+// the threaded interpreter, which calls each specialization directly.
+//
+// Every field that lives in bits 15-6 is a template parameter, so the handlers only
+// decode the low register fields at run time.
+
+template <uint32_t Op, uint32_t Offset>
+void ARM7CPU::thumb_move_shifted(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t source = cpu.registers[(instruction >> 3) & 7];
+
+    // LSL #0 keeps C; LSR/ASR #0 encode a shift by 32
+    if constexpr (Op == 0 && Offset == 0) {
+        cpu.registers[rd] = source;
+        cpu.flags.set_nz(source);
+    } else {
+        bool carry = false;
+        const uint32_t result = shift_operand<Op, true, true>(source, Offset, carry);
+        cpu.registers[rd] = result;
+        cpu.flags.set_logic(result, carry);
+    }
+}
+
+template <bool Immediate, bool Subtract, uint32_t Operand>
+void ARM7CPU::thumb_add_subtract(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t operand1 = cpu.registers[(instruction >> 3) & 7];
+    const uint32_t operand2 = Immediate ? Operand : cpu.registers[Operand];
+
+    if constexpr (Subtract) {
+        cpu.registers[rd] = cpu.flags.add(operand1, ~operand2, true);
+    } else {
+        cpu.registers[rd] = cpu.flags.add(operand1, operand2, false);
+    }
+}
+
+template <uint32_t Op, uint32_t Rd>
+void ARM7CPU::thumb_immediate(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t immediate = instruction & 0xFF;
+
+    if constexpr (Op == 0) {
+        // MOV leaves C and V alone
+        cpu.registers[Rd] = immediate;
+        cpu.flags.set_nz(immediate);
+    } else {
+        uint32_t result;
+        if constexpr (Op == 2) {
+            result = cpu.flags.add(cpu.registers[Rd], immediate, false);
+        } else {
+            result = cpu.flags.add(cpu.registers[Rd], ~immediate, true);
+        }
+
+        // CMP only updates the flags
+        if constexpr (Op != 1) {
+            cpu.registers[Rd] = result;
+        }
+    }
+}
+
+template <uint32_t Op>
+void ARM7CPU::thumb_alu(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t operand1 = cpu.registers[rd];
+    const uint32_t operand2 = cpu.registers[(instruction >> 3) & 7];
+    uint32_t result;
+
+    // The logical operations leave C and V alone
+    if constexpr (Op == 0x0 || Op == 0x8) {
+        // AND, TST
+        result = operand1 & operand2;
+        cpu.flags.set_nz(result);
+    } else if constexpr (Op == 0x1) {
+        // EOR
+        result = operand1 ^ operand2;
+        cpu.flags.set_nz(result);
+    } else if constexpr (Op == 0x2 || Op == 0x3 || Op == 0x4 || Op == 0x7) {
+        // LSL, LSR, ASR, ROR by register; a zero amount keeps C
+        constexpr uint32_t shift_type = Op == 0x2 ? 0 : Op == 0x3 ? 1 : Op == 0x4 ? 2 : 3;
+        const uint32_t amount = operand2 & 0xFF;
+        if (amount == 0) {
+            result = operand1;
+            cpu.flags.set_nz(result);
+        } else {
+            bool carry = false;
+            result = shift_operand<shift_type, false, true>(operand1, amount, carry);
+            cpu.flags.set_logic(result, carry);
+        }
+        cpu.cycles++;
+    } else if constexpr (Op == 0x5) {
+        // ADC
+        result = cpu.flags.add(operand1, operand2, cpu.flags.c());
+    } else if constexpr (Op == 0x6) {
+        // SBC
+        result = cpu.flags.add(operand1, ~operand2, cpu.flags.c());
+    } else if constexpr (Op == 0x9) {
+        // NEG
+        result = cpu.flags.add(0, ~operand2, true);
+    } else if constexpr (Op == 0xA) {
+        // CMP
+        result = cpu.flags.add(operand1, ~operand2, true);
+    } else if constexpr (Op == 0xB) {
+        // CMN
+        result = cpu.flags.add(operand1, operand2, false);
+    } else if constexpr (Op == 0xC) {
+        // ORR
+        result = operand1 | operand2;
+        cpu.flags.set_nz(result);
+    } else if constexpr (Op == 0xD) {
+        // MUL
+        result = operand1 * operand2;
+        cpu.flags.set_nz(result);
+        cpu.cycles += multiply_cycles(operand1);
+    } else if constexpr (Op == 0xE) {
+        // BIC
+        result = operand1 & ~operand2;
+        cpu.flags.set_nz(result);
+    } else {
+        // MVN
+        result = ~operand2;
+        cpu.flags.set_nz(result);
+    }
+
+    // TST, CMP and CMN only update the flags
+    if constexpr (Op != 0x8 && Op != 0xA && Op != 0xB) {
+        cpu.registers[rd] = result;
+    }
+}
+
+template <uint32_t Op, bool HighRd, bool HighRs>
+void ARM7CPU::thumb_hi_register(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = (instruction & 7) | (HighRd ? 8 : 0);
+    const uint32_t operand = cpu.registers[((instruction >> 3) & 7) | (HighRs ? 8 : 0)];
+
+    if constexpr (Op == 0) {
+        // ADD
+        const uint32_t result = cpu.registers[rd] + operand;
+        if (rd == 15) {
+            cpu.branch_to(result);
+        } else {
+            cpu.registers[rd] = result;
+        }
+    } else if constexpr (Op == 1) {
+        // CMP
+        cpu.flags.add(cpu.registers[rd], ~operand, true);
+    } else if constexpr (Op == 2) {
+        // MOV
+        if (rd == 15) {
+            cpu.branch_to(operand);
+        } else {
+            cpu.registers[rd] = operand;
+        }
+    } else {
+        // BX
+        cpu.thumb_mode = (operand & 1) != 0;
+        if (!cpu.thumb_mode) {
+            cpu.cpsr &= ~FLAG_T;
+        }
+        cpu.branch_to(operand);
+    }
+}
+
+template <uint32_t Rd>
+void ARM7CPU::thumb_pc_relative_load(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    // The PC is word-aligned for the address calculation
+    const uint32_t address = (cpu.registers[15] & ~2u) + (instruction & 0xFF) * 4;
+    cpu.registers[Rd] = gba.memory.read32(address);
+    cpu.cycles += 2;
+}
+
+template <bool Load, bool Byte, uint32_t Ro>
+void ARM7CPU::thumb_register_offset(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t address = cpu.registers[(instruction >> 3) & 7] + cpu.registers[Ro];
+
+    if constexpr (Load) {
+        cpu.registers[rd] = Byte ? gba.memory.read8(address) : read_word_rotated(gba.memory, address);
+        cpu.cycles += 2;
+    } else {
+        if constexpr (Byte) {
+            gba.memory.write8(address, cpu.registers[rd] & 0xFF);
+        } else {
+            gba.memory.write32(address, cpu.registers[rd]);
+        }
+        cpu.cycles++;
+    }
+}
+
+template <bool Halfword, bool SignExtend, uint32_t Ro>
+void ARM7CPU::thumb_sign_extended(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t address = cpu.registers[(instruction >> 3) & 7] + cpu.registers[Ro];
+
+    if constexpr (!Halfword && !SignExtend) {
+        // STRH
+        gba.memory.write16(address & ~1, cpu.registers[rd] & 0xFFFF);
+        cpu.cycles++;
+        return;
+    } else if constexpr (Halfword && !SignExtend) {
+        // LDRH: misaligned loads rotate the halfword
+        cpu.registers[rd] = std::rotr(static_cast<uint32_t>(gba.memory.read16(address & ~1)), (address & 1) * 8);
+    } else if constexpr (!Halfword) {
+        // LDSB
+        cpu.registers[rd] = static_cast<uint32_t>(static_cast<int8_t>(gba.memory.read8(address)));
+    } else {
+        // LDSH: misaligned loads behave like LDSB
+        if (address & 1) {
+            cpu.registers[rd] = static_cast<uint32_t>(static_cast<int8_t>(gba.memory.read8(address)));
+        } else {
+            cpu.registers[rd] = static_cast<uint32_t>(static_cast<int16_t>(gba.memory.read16(address)));
+        }
+    }
+    cpu.cycles += 2;
+}
+
+template <bool Byte, bool Load, uint32_t Offset>
+void ARM7CPU::thumb_immediate_offset(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t address = cpu.registers[(instruction >> 3) & 7] + (Byte ? Offset : Offset * 4);
+
+    if constexpr (Load) {
+        cpu.registers[rd] = Byte ? gba.memory.read8(address) : read_word_rotated(gba.memory, address);
+        cpu.cycles += 2;
+    } else {
+        if constexpr (Byte) {
+            gba.memory.write8(address, cpu.registers[rd] & 0xFF);
+        } else {
+            gba.memory.write32(address, cpu.registers[rd]);
+        }
+        cpu.cycles++;
+    }
+}
+
+template <bool Load, uint32_t Offset>
+void ARM7CPU::thumb_halfword_offset(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t rd = instruction & 7;
+    const uint32_t address = cpu.registers[(instruction >> 3) & 7] + Offset * 2;
+
+    if constexpr (Load) {
+        cpu.registers[rd] = std::rotr(static_cast<uint32_t>(gba.memory.read16(address & ~1)), (address & 1) * 8);
+        cpu.cycles += 2;
+    } else {
+        gba.memory.write16(address & ~1, cpu.registers[rd] & 0xFFFF);
+        cpu.cycles++;
+    }
+}
+
+template <bool Load, uint32_t Rd>
+void ARM7CPU::thumb_sp_relative(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t address = cpu.registers[13] + (instruction & 0xFF) * 4;
+
+    if constexpr (Load) {
+        cpu.registers[Rd] = read_word_rotated(gba.memory, address);
+        cpu.cycles += 2;
+    } else {
+        gba.memory.write32(address, cpu.registers[Rd]);
+        cpu.cycles++;
+    }
+}
+
+template <bool FromSp, uint32_t Rd>
+void ARM7CPU::thumb_load_address(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t base = FromSp ? cpu.registers[13] : (cpu.registers[15] & ~2u);
+    cpu.registers[Rd] = base + (instruction & 0xFF) * 4;
+}
+
+template <bool Negative>
+void ARM7CPU::thumb_adjust_sp(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t offset = (instruction & 0x7F) * 4;
+    if constexpr (Negative) {
+        cpu.registers[13] -= offset;
+    } else {
+        cpu.registers[13] += offset;
+    }
+}
+
+template <bool Load, bool PcLr>
+void ARM7CPU::thumb_push_pop(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t register_list = instruction & 0xFF;
+    const uint32_t count = std::popcount(register_list) + (PcLr ? 1 : 0);
+
+    if constexpr (Load) {
+        // POP {rlist, PC}
+        uint32_t address = cpu.registers[13];
+        if (const uint32_t* source = gba.memory.ram_words(address, count)) {
+            // The whole range is in EWRAM or IWRAM
+            for (uint32_t reg = 0; reg < 8; reg++) {
+                if (register_list & (1 << reg)) cpu.registers[reg] = *source++;
+            }
+            cpu.registers[13] = address + count * 4;
+            if constexpr (PcLr) cpu.branch_to(*source);
+            cpu.cycles += count + 1;
+            return;
+        }
+        for (uint32_t reg = 0; reg < 8; reg++) {
+            if (register_list & (1 << reg)) {
+                cpu.registers[reg] = gba.memory.read32(address);
+                address += 4;
+            }
+        }
+        cpu.registers[13] = address + (PcLr ? 4 : 0);
+        if constexpr (PcLr) {
+            // ARMv4T ignores bit 0 here and stays in Thumb state
+            cpu.branch_to(gba.memory.read32(address));
+        }
+        cpu.cycles += count + 1;
+    } else {
+        // PUSH {rlist, LR}
+        uint32_t address = cpu.registers[13] - count * 4;
+        cpu.registers[13] = address;
+        if (uint32_t* destination = gba.memory.writable_ram_words(address, count)) {
+            // The whole range is in EWRAM or IWRAM
+            for (uint32_t reg = 0; reg < 8; reg++) {
+                if (register_list & (1 << reg)) *destination++ = cpu.registers[reg];
+            }
+            if constexpr (PcLr) *destination = cpu.registers[14];
+            if (gba.memory.write_log) gba.memory.log_ram_words(address, count);
+            cpu.cycles += count;
+            return;
+        }
+        for (uint32_t reg = 0; reg < 8; reg++) {
+            if (register_list & (1 << reg)) {
+                gba.memory.write32(address, cpu.registers[reg]);
+                address += 4;
+            }
+        }
+        if constexpr (PcLr) {
+            gba.memory.write32(address, cpu.registers[14]);
+        }
+        cpu.cycles += count;
+    }
+}
+
+template <bool Load, uint32_t Rb>
+void ARM7CPU::thumb_multiple(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    const uint32_t register_list = instruction & 0xFF;
+    uint32_t address = cpu.registers[Rb];
+
+    // An empty list transfers R15 and moves the base by 0x40
+    if (register_list == 0) {
+        if constexpr (Load) {
+            cpu.registers[Rb] = address + 0x40;
+            cpu.branch_to(gba.memory.read32(address));
+        } else {
+            cpu.registers[Rb] = address + 0x40;
+            gba.memory.write32(address, cpu.registers[15] + 2);
+        }
+        return;
+    }
+
+    const uint32_t count = std::popcount(register_list);
+    const uint32_t final_base = address + count * 4;
+
+    // A range inside EWRAM or IWRAM is accessed through the backing array directly
+    const uint32_t* source = nullptr;
+    uint32_t* destination = nullptr;
+    if constexpr (Load) {
+        source = gba.memory.ram_words(address, count);
+    } else {
+        destination = gba.memory.writable_ram_words(address, count);
+    }
+
+    bool first = true;
+    for (uint32_t reg = 0; reg < 8; reg++) {
+        if (!(register_list & (1 << reg))) continue;
+
+        if constexpr (Load) {
+            cpu.registers[reg] = source ? *source++ : gba.memory.read32(address);
+        } else if (destination) {
+            *destination++ = cpu.registers[reg];
+        } else {
+            gba.memory.write32(address, cpu.registers[reg]);
+        }
+
+        // Writeback happens after the first transfer; a loaded base wins
+        if (first && !(Load && (register_list & (1 << Rb)))) {
+            cpu.registers[Rb] = final_base;
+        }
+        first = false;
+        address += 4;
+    }
+    if (destination && gba.memory.write_log) gba.memory.log_ram_words(final_base - count * 4, count);
+
+    cpu.cycles += count + (Load ? 1 : 0);
+}
+
+template <uint32_t Condition>
+void ARM7CPU::thumb_conditional_branch(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    if (!cpu.check_condition(Condition)) {
+        return;
+    }
+
+    const int32_t offset = static_cast<int32_t>(static_cast<int8_t>(instruction & 0xFF)) * 2;
+    cpu.branch_to(cpu.registers[15] + offset);
+}
+
+template <bool Second>
+void ARM7CPU::thumb_long_branch(ARM7CPU& cpu, GBASystem& gba, uint16_t instruction) {
+    if constexpr (!Second) {
+        // BL prefix: LR = PC + (offset << 12)
+        const int32_t offset = static_cast<int32_t>(static_cast<uint32_t>(instruction) << 21) >> 9;
+        cpu.registers[14] = cpu.registers[15] + offset;
+    } else {
+        // BL suffix: branch to LR + (offset << 1) and leave the return address in LR
+        const uint32_t target = cpu.registers[14] + (instruction & 0x7FF) * 2;
+        cpu.registers[14] = cpu.next_instruction_address() | 1;
+        cpu.branch_to(target);
+    }
+}
+
+
+template <uint32_t Index>
+constexpr ARM7CPU::ThumbHandler ARM7CPU::decode_thumb() {
+    // Index = bits 15-6 of the instruction
+    constexpr uint32_t instruction = Index << 6;
+
+    if constexpr ((instruction & 0xF800) == 0x1800) {
+        return &thumb_add_subtract<(instruction >> 10) & 1, (instruction >> 9) & 1, (instruction >> 6) & 7>;
+    } else if constexpr ((instruction & 0xE000) == 0x0000) {
+        return &thumb_move_shifted<(instruction >> 11) & 3, (instruction >> 6) & 0x1F>;
+    } else if constexpr ((instruction & 0xE000) == 0x2000) {
+        return &thumb_immediate<(instruction >> 11) & 3, (instruction >> 8) & 7>;
+    } else if constexpr ((instruction & 0xFC00) == 0x4000) {
+        return &thumb_alu<(instruction >> 6) & 0xF>;
+    } else if constexpr ((instruction & 0xFC00) == 0x4400) {
+        return &thumb_hi_register<(instruction >> 8) & 3, ((instruction >> 7) & 1) != 0, ((instruction >> 6) & 1) != 0>;
+    } else if constexpr ((instruction & 0xF800) == 0x4800) {
+        return &thumb_pc_relative_load<(instruction >> 8) & 7>;
+    } else if constexpr ((instruction & 0xF200) == 0x5000) {
+        return &thumb_register_offset<((instruction >> 11) & 1) != 0, ((instruction >> 10) & 1) != 0, (instruction >> 6) & 7>;
+    } else if constexpr ((instruction & 0xF200) == 0x5200) {
+        return &thumb_sign_extended<((instruction >> 11) & 1) != 0, ((instruction >> 10) & 1) != 0, (instruction >> 6) & 7>;
+    } else if constexpr ((instruction & 0xE000) == 0x6000) {
+        return &thumb_immediate_offset<((instruction >> 12) & 1) != 0, ((instruction >> 11) & 1) != 0, (instruction >> 6) & 0x1F>;
+    } else if constexpr ((instruction & 0xF000) == 0x8000) {
+        return &thumb_halfword_offset<((instruction >> 11) & 1) != 0, (instruction >> 6) & 0x1F>;
+    } else if constexpr ((instruction & 0xF000) == 0x9000) {
+        return &thumb_sp_relative<((instruction >> 11) & 1) != 0, (instruction >> 8) & 7>;
+    } else if constexpr ((instruction & 0xF000) == 0xA000) {
+        return &thumb_load_address<((instruction >> 11) & 1) != 0, (instruction >> 8) & 7>;
+    } else if constexpr ((instruction & 0xFF00) == 0xB000) {
+        return &thumb_adjust_sp<((instruction >> 7) & 1) != 0>;
+    } else if constexpr ((instruction & 0xF600) == 0xB400) {
+        return &thumb_push_pop<((instruction >> 11) & 1) != 0, ((instruction >> 8) & 1) != 0>;
+    } else if constexpr ((instruction & 0xF000) == 0xC000) {
+        return &thumb_multiple<((instruction >> 11) & 1) != 0, (instruction >> 8) & 7>;
+    } else if constexpr ((instruction & 0xFF00) == 0xDF00) {
+        return &thumb_software_interrupt;
+    } else if constexpr ((instruction & 0xF000) == 0xD000 && (instruction & 0x0F00) != 0x0E00) {
+        return &thumb_conditional_branch<(instruction >> 8) & 0xF>;
+    } else if constexpr ((instruction & 0xF800) == 0xE000) {
+        return &thumb_branch;
+    } else if constexpr ((instruction & 0xF000) == 0xF000) {
+        return &thumb_long_branch<((instruction >> 11) & 1) != 0>;
+    } else {
+        return &thumb_undefined;
+    }
+}
@@ -0,0 +1,213 @@
+// cpu/x64_emitter.h
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Minimal x86-64 assembler for the JIT. Only the encodings the translator needs are provided;
+// all direct jumps are rel32 and all code is position independent.
+
+enum X64Reg : uint8_t {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// x86 condition codes, as used by Jcc and SETcc
+enum X64Cond : uint8_t {
+    CC_O = 0x0, CC_NO = 0x1, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_S = 0x8, CC_NS = 0x9, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+// Group 1 ALU operations (the /digit of 81 and the opcode of the r/m, reg form)
+enum X64Alu : uint8_t {
+    ALU_ADD = 0, ALU_OR = 1, ALU_ADC = 2, ALU_SBB = 3, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7
+};
+
+// Group 2 shift operations (the /digit of C1)
+enum X64Shift : uint8_t {
+    SHIFT_ROL = 0, SHIFT_ROR = 1, SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7
+};
+
+// [base + index * scale + disp]
+struct X64Mem {
+    X64Reg base;
+    int32_t disp = 0;
+    int index = -1;
+    int scale = 1;
+};
+
+class X64Emitter {
+public:
+    using Label = uint32_t;
+
+    std::vector<uint8_t> code;
+
+    // Labels are bound once; jumps are patched by finish()
+    Label new_label() {
+        labels.push_back(-1);
+        return static_cast<Label>(labels.size() - 1);
+    }
+
+    void bind(Label label) {
+        labels[label] = static_cast<int32_t>(code.size());
+    }
+
+    // Code offset of a bound label, or of the next instruction
+    int32_t offset_of(Label label) const { return labels[label]; }
+    uint32_t position() const { return static_cast<uint32_t>(code.size()); }
+
+    // Resolve every jump; call once after the last instruction
+    void finish() {
+        for (const Fixup& fixup : fixups) {
+            const int32_t rel = labels[fixup.label] - static_cast<int32_t>(fixup.offset + 4 + fixup.trailing);
+            std::memcpy(&code[fixup.offset], &rel, 4);
+        }
+        fixups.clear();
+    }
+
+    // Moves
+    void mov(X64Reg dst, X64Reg src) { rex(false, src, dst); byte(0x89); modrm_reg(src, dst); }
+    void mov64(X64Reg dst, X64Reg src) { rex(true, src, dst); byte(0x89); modrm_reg(src, dst); }
+    // Never shortened to XOR, so it can sit between a compare and its branch
+    void mov(X64Reg dst, uint32_t imm) {
+        if (dst >= 8) byte(0x41);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+    void load(X64Reg dst, const X64Mem& m) { rex_mem(false, dst, m); byte(0x8B); modrm_mem(dst, m); }
+    void load64(X64Reg dst, const X64Mem& m) { rex_mem(true, dst, m); byte(0x8B); modrm_mem(dst, m); }
+    void load_byte(X64Reg dst, const X64Mem& m) { rex_mem(false, dst, m); byte(0x0F); byte(0xB6); modrm_mem(dst, m); }
+    void store(const X64Mem& m, X64Reg src) { rex_mem(false, src, m); byte(0x89); modrm_mem(src, m); }
+    void store64(const X64Mem& m, X64Reg src) { rex_mem(true, src, m); byte(0x89); modrm_mem(src, m); }
+    void store(const X64Mem& m, uint32_t imm) { rex_mem(false, RAX, m); byte(0xC7); modrm_mem(0, m); dword(imm); }
+    // Byte stores only take AL/CL/DL/BL as the source so no REX prefix changes their meaning
+    void store_byte(const X64Mem& m, X64Reg src) { rex_mem(false, src, m); byte(0x88); modrm_mem(src, m); }
+    void store_byte(const X64Mem& m, uint8_t imm) { rex_mem(false, RAX, m); byte(0xC6); modrm_mem(0, m); byte(imm); }
+
+    // Arithmetic
+    void alu(X64Alu op, X64Reg dst, X64Reg src) { rex(false, src, dst); byte(op * 8 + 1); modrm_reg(src, dst); }
+    void alu(X64Alu op, X64Reg dst, const X64Mem& m) { rex_mem(false, dst, m); byte(op * 8 + 3); modrm_mem(dst, m); }
+    void alu64(X64Alu op, X64Reg dst, const X64Mem& m) { rex_mem(true, dst, m); byte(op * 8 + 3); modrm_mem(dst, m); }
+    void alu(X64Alu op, X64Reg dst, uint32_t imm) {
+        rex(false, RAX, dst);
+        if (fits_int8(imm)) {
+            byte(0x83); modrm_reg(op, dst); byte(static_cast<uint8_t>(imm));
+        } else {
+            byte(0x81); modrm_reg(op, dst); dword(imm);
+        }
+    }
+    void alu(X64Alu op, const X64Mem& m, uint32_t imm) {
+        rex_mem(false, RAX, m);
+        if (fits_int8(imm)) {
+            byte(0x83); modrm_mem(op, m); byte(static_cast<uint8_t>(imm));
+        } else {
+            byte(0x81); modrm_mem(op, m); dword(imm);
+        }
+    }
+    void alu64(X64Alu op, X64Reg dst, uint32_t imm) {
+        rex(true, RAX, dst);
+        if (fits_int8(imm)) {
+            byte(0x83); modrm_reg(op, dst); byte(static_cast<uint8_t>(imm));
+        } else {
+            byte(0x81); modrm_reg(op, dst); dword(imm);
+        }
+    }
+    void alu64(X64Alu op, const X64Mem& m, uint32_t imm) {
+        rex_mem(true, RAX, m);
+        if (fits_int8(imm)) {
+            byte(0x83); modrm_mem(op, m); byte(static_cast<uint8_t>(imm));
+        } else {
+            byte(0x81); modrm_mem(op, m); dword(imm);
+        }
+    }
+    void cmp_byte(const X64Mem& m, uint8_t imm) { rex_mem(false, RAX, m); byte(0x80); modrm_mem(ALU_CMP, m); byte(imm); }
+    void test(X64Reg a, X64Reg b) { rex(false, b, a); byte(0x85); modrm_reg(b, a); }
+    void test64(X64Reg a, X64Reg b) { rex(true, b, a); byte(0x85); modrm_reg(b, a); }
+    void test(X64Reg a, uint32_t imm) { rex(false, RAX, a); byte(0xF7); modrm_reg(0, a); dword(imm); }
+    void shift(X64Shift op, X64Reg dst, uint8_t amount) { rex(false, RAX, dst); byte(0xC1); modrm_reg(op, dst); byte(amount); }
+    void not_(X64Reg dst) { rex(false, RAX, dst); byte(0xF7); modrm_reg(2, dst); }
+    void neg(X64Reg dst) { rex(false, RAX, dst); byte(0xF7); modrm_reg(3, dst); }
+    void imul(X64Reg dst, X64Reg src) { rex(false, dst, src); byte(0x0F); byte(0xAF); modrm_reg(dst, src); }
+
+    // Bit tests leave the bit in CF
+    void bt(X64Reg value, uint8_t bit) { rex(false, RAX, value); byte(0x0F); byte(0xBA); modrm_reg(4, value); byte(bit); }
+    void bt64(const X64Mem& m, X64Reg bit) { rex_mem(true, bit, m); byte(0x0F); byte(0xA3); modrm_mem(bit, m); }
+    void setcc(X64Cond cond, const X64Mem& m) { rex_mem(false, RAX, m); byte(0x0F); byte(0x90 + cond); modrm_mem(0, m); }
+
+    // Control flow
+    void jcc(X64Cond cond, Label target) { byte(0x0F); byte(0x80 + cond); fixup(target); }
+    void jmp(Label target) { byte(0xE9); fixup(target); }
+    void jmp(X64Reg target) { rex(false, RAX, target); byte(0xFF); modrm_reg(4, target); }
+    // jmp qword [rip + cell]
+    void jmp_indirect(Label cell) { byte(0xFF); byte(0x25); fixup(cell); }
+    void call(const X64Mem& m) { rex_mem(false, RAX, m); byte(0xFF); modrm_mem(2, m); }
+    void push(X64Reg r) { if (r >= 8) byte(0x41); byte(0x50 + (r & 7)); }
+    void pop(X64Reg r) { if (r >= 8) byte(0x41); byte(0x58 + (r & 7)); }
+    void ret() { byte(0xC3); }
+
+    // mov byte [rip + label], imm
+    void store_byte(Label label, uint8_t imm) { byte(0xC6); byte(0x05); fixup(label, 1); byte(imm); }
+
+    // RIP-relative address of a label (used for data cells placed after the code)
+    void lea(X64Reg dst, Label label) {
+        rex(true, dst, RAX);
+        byte(0x8D);
+        byte(((dst & 7) << 3) | 5);
+        fixup(label);
+    }
+
+    // Data
+    void align(uint32_t boundary) { while (code.size() % boundary) byte(0xCC); }
+    void data64(uint64_t value) {
+        for (int i = 0; i < 8; i++) code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+
+private:
+    struct Fixup {
+        uint32_t offset;
+        Label label;
+        uint32_t trailing;  // Instruction bytes after the rel32
+    };
+
+    std::vector<int32_t> labels;
+    std::vector<Fixup> fixups;
+
+    static bool fits_int8(uint32_t imm) {
+        return static_cast<int32_t>(imm) >= -128 && static_cast<int32_t>(imm) <= 127;
+    }
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void dword(uint32_t d) {
+        for (int i = 0; i < 4; i++) code.push_back(static_cast<uint8_t>(d >> (i * 8)));
+    }
+    void fixup(Label target, uint32_t trailing = 0) {
+        fixups.push_back({static_cast<uint32_t>(code.size()), target, trailing});
+        dword(0);
+    }
+
+    // REX for a register-direct r/m operand
+    void rex(bool wide, int reg, int rm) {
+        const uint8_t value = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+        if (value != 0x40) byte(value);
+    }
+    void rex_mem(bool wide, int reg, const X64Mem& m) {
+        const int index = m.index < 0 ? 0 : m.index;
+        const uint8_t value = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (m.base >> 3);
+        if (value != 0x40) byte(value);
+    }
+    void modrm_reg(int reg, int rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+    void modrm_mem(int reg, const X64Mem& m) {
+        // RBP/R13 as a base always need a displacement; RSP/R12 always need a SIB byte
+        const bool sib = m.index >= 0 || (m.base & 7) == RSP;
+        const int mod = (m.disp == 0 && (m.base & 7) != RBP) ? 0 : fits_int8(m.disp) ? 1 : 2;
+        byte((mod << 6) | ((reg & 7) << 3) | (sib ? 4 : (m.base & 7)));
+        if (sib) {
+            const int scale_bits = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+            const int index = m.index < 0 ? RSP : m.index;
+            byte((scale_bits << 6) | ((index & 7) << 3) | (m.base & 7));
+        }
+        if (mod == 1) byte(static_cast<uint8_t>(m.disp));
+        if (mod == 2) dword(static_cast<uint32_t>(m.disp));
+    }
+};
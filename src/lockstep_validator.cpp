@@ -0,0 +1,140 @@
+// lockstep_validator.cpp
+#include "lockstep_validator.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+// Names for the banks compared, in ARM7CPU::get_mode_index order
+static const char* const BANK_NAMES[] = {"usr", "fiq", "irq", "svc", "abt", "und"};
+
+static std::string hex(uint32_t value) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::setw(8) << std::setfill('0') << value;
+    return out.str();
+}
+
+static std::string describe(const MemoryWrite& write) {
+    std::ostringstream out;
+    out << "[" << hex(write.address) << "] = " << hex(write.value) << " (" << static_cast<int>(write.size) << " bytes)";
+    return out.str();
+}
+
+LockstepValidator::LockstepValidator(ExecutionMode mode) {
+    reference.init();
+    engine.init();
+    reference.cpu.execution_mode = ExecutionMode::INTERPRETER;
+    engine.cpu.execution_mode = mode;
+    reference.memory.write_log = &reference_writes;
+    engine.memory.write_log = &engine_writes;
+}
+
+bool LockstepValidator::load_rom(const std::string& filename) {
+    if (!reference.load_rom(filename) || !engine.load_rom(filename)) return false;
+    reference.running = true;
+    engine.running = true;
+    return true;
+}
+
+bool LockstepValidator::load_idle_loops(const std::string& filename) {
+    return reference.load_idle_loops(filename) && engine.load_idle_loops(filename);
+}
+
+bool LockstepValidator::run_frames(int frames) {
+    for (int frame = 0; frame < frames; frame++) {
+        // As GBASystem::run_frame(), with the engine's slices replayed on the reference
+        int frame_cycles = 0;
+        while (frame_cycles < CYCLES_PER_FRAME) {
+            const uint64_t start = engine.cycles;
+            if (!step(std::min(engine.ppu.cycles_until_event(), CYCLES_PER_FRAME - frame_cycles))) return false;
+            frame_cycles += static_cast<int>(engine.cycles - start);
+        }
+    }
+    return true;
+}
+
+bool LockstepValidator::step(int budget) {
+    const uint32_t slice_pc = engine.cpu.program_counter();
+    reference_writes.clear();
+    engine_writes.clear();
+    const uint64_t reference_idle = reference.cpu.idle_cycles_skipped;
+    const uint64_t engine_idle = engine.cpu.idle_cycles_skipped;
+
+    // The engine may run past budget to finish a block, or stop early on a yield or IRQ. The
+    // interpreter then runs until it has used as many cycles, which ends on the same instruction
+    // if both agree.
+    const int engine_elapsed = engine.cpu.run(engine, budget);
+    const int reference_elapsed = reference.cpu.run(reference, std::max(engine_elapsed, 1));
+
+    engine.ppu.advance(engine, engine_elapsed);
+    engine.cycles += engine_elapsed;
+    reference.ppu.advance(reference, reference_elapsed);
+    reference.cycles += reference_elapsed;
+
+    slices_compared++;
+    return compare(slice_pc, reference_elapsed, engine_elapsed, reference.cpu.idle_cycles_skipped - reference_idle,
+                   engine.cpu.idle_cycles_skipped - engine_idle);
+}
+
+bool LockstepValidator::compare(uint32_t slice_pc, int reference_elapsed, int engine_elapsed, uint64_t reference_skipped,
+                                uint64_t engine_skipped) {
+    ARM7CPU& ref = reference.cpu;
+    ARM7CPU& eng = engine.cpu;
+    std::ostringstream diff;
+
+    if (reference_elapsed != engine_elapsed || ref.cycles != eng.cycles) {
+        diff << "  cycles: reference " << ref.cycles << " (+" << reference_elapsed << "), engine " << eng.cycles
+             << " (+" << engine_elapsed << ")\n";
+    }
+    // The interpreter only skips configured loops, which the engine must skip too; it may also
+    // skip loops it detected itself, so only a slice where it skipped nothing is a difference
+    if (reference_skipped && !engine_skipped) {
+        diff << "  idle loop: reference skipped " << reference_skipped << " cycles, engine none\n";
+    }
+    if (ref.program_counter() != eng.program_counter()) {
+        diff << "  next pc: reference " << hex(ref.program_counter()) << ", engine " << hex(eng.program_counter()) << "\n";
+    }
+    if (ref.get_cpsr() != eng.get_cpsr()) {
+        diff << "  cpsr: reference " << hex(ref.get_cpsr()) << ", engine " << hex(eng.get_cpsr()) << "\n";
+    }
+    for (size_t bank = 0; bank < ref.spsr.size(); bank++) {
+        if (ref.spsr[bank] != eng.spsr[bank]) {
+            diff << "  spsr_" << BANK_NAMES[bank] << ": reference " << hex(ref.spsr[bank]) << ", engine "
+                 << hex(eng.spsr[bank]) << "\n";
+        }
+    }
+
+    // Banks share most of their registers; report each physical register once
+    for (int bank = 0; bank < 6; bank++) {
+        for (uint32_t reg = 0; reg < 16; reg++) {
+            if (bank > 0 && RegisterFile::bank_maps[bank][reg] == RegisterFile::bank_maps[0][reg]) continue;
+            // R15 is compared as the next PC above, as it depends on the pipeline state
+            if (reg == 15) continue;
+            const uint32_t expected = ref.registers.banked(bank, reg);
+            const uint32_t actual = eng.registers.banked(bank, reg);
+            if (expected != actual) {
+                diff << "  r" << reg << (bank > 0 ? std::string("_") + BANK_NAMES[bank] : "") << ": reference "
+                     << hex(expected) << ", engine " << hex(actual) << "\n";
+            }
+        }
+    }
+
+    if (reference_writes != engine_writes) {
+        const size_t count = std::max(reference_writes.size(), engine_writes.size());
+        diff << "  stores: reference made " << reference_writes.size() << ", engine " << engine_writes.size() << "\n";
+        for (size_t i = 0; i < count; i++) {
+            const bool in_reference = i < reference_writes.size();
+            const bool in_engine = i < engine_writes.size();
+            if (in_reference && in_engine && reference_writes[i] == engine_writes[i]) continue;
+            diff << "    #" << i << ": reference " << (in_reference ? describe(reference_writes[i]) : "-")
+                 << ", engine " << (in_engine ? describe(engine_writes[i]) : "-") << "\n";
+        }
+    }
+
+    if (diff.tellp() == 0) return true;
+
+    std::ostringstream out;
+    out << "Divergence in the slice from " << hex(slice_pc) << (eng.thumb_mode ? " (Thumb)" : " (ARM)") << " after "
+        << slices_compared << " slices, cycle " << ref.cycles << ":\n" << diff.str();
+    report = out.str();
+    return false;
+}
@@ -0,0 +1,41 @@
+// lockstep_validator.h
+#pragma once
+
+#include "system.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Runs the interpreter and a faster execution mode side by side on two systems loaded with the
+// same ROM. The engine under test runs the slices GBASystem::run_frame() would give it, so
+// translated blocks chain and predict returns as they do in a real run. After each slice the
+// interpreter runs the same number of cycles and the two are compared: all banked registers,
+// CPSR and SPSRs, the next PC, the cycle count and the stores each made during the slice. The
+// first difference stops the run.
+class LockstepValidator {
+public:
+    explicit LockstepValidator(ExecutionMode mode);
+
+    GBASystem reference;    // ExecutionMode::INTERPRETER
+    GBASystem engine;       // The mode being validated
+
+    bool load_rom(const std::string& filename);
+
+    // Give both systems the ROM's idle loops (GBASystem::load_idle_loops()). A slice in which the
+    // reference skips one then also counts as a divergence if the engine skipped nothing.
+    bool load_idle_loops(const std::string& filename);
+
+    // Run up to frames frames; false at the first divergence, which is described in report
+    bool run_frames(int frames);
+
+    uint64_t slices_compared = 0;
+    std::string report;
+
+private:
+    std::vector<MemoryWrite> reference_writes;
+    std::vector<MemoryWrite> engine_writes;
+
+    bool step(int budget);
+    bool compare(uint32_t slice_pc, int reference_elapsed, int engine_elapsed, uint64_t reference_skipped,
+                 uint64_t engine_skipped);
+};
@@ -1,16 +1,79 @@
 // main.cpp
+#include <cstdlib>
 #include <iostream>
+#include <string>
 #include "system.h"
+#include "lockstep_validator.h"
+
+#ifdef DEBUG_TRACE
+#include <csignal>
+
+// Dump the CPU trace ring buffer if the emulator crashes
+static GBASystem* traced_system = nullptr;
+
+static void dump_trace_on_crash(int signal_number) {
+    if (traced_system) {
+        traced_system->cpu.trace.dump("breadedgba_trace.bin");
+    }
+    std::signal(signal_number, SIG_DFL);
+    std::raise(signal_number);
+}
+#endif
+
+// Check an execution mode against the interpreter; see LockstepValidator
+static int validate(const std::string& mode_name, const char* rom_file, int frames, const char* idle_loops_file) {
+    ExecutionMode mode;
+    if (mode_name == "cache") mode = ExecutionMode::BLOCK_CACHE;
+    else if (mode_name == "jit") mode = ExecutionMode::JIT;
+    else if (mode_name == "tiered") mode = ExecutionMode::TIERED;
+    else {
+        std::cout << "Unknown execution mode: " << mode_name << std::endl;
+        return 1;
+    }
+
+    LockstepValidator validator(mode);
+    if (!validator.load_rom(rom_file)) {
+        return 1;
+    }
+    if (idle_loops_file && !validator.load_idle_loops(idle_loops_file)) {
+        std::cout << "Cannot read idle loops: " << idle_loops_file << std::endl;
+        return 1;
+    }
+    if (!validator.run_frames(frames)) {
+        std::cout << validator.report;
+        return 2;
+    }
+    std::cout << "No divergence in " << validator.slices_compared << " slices over " << frames << " frames" << std::endl;
+    return 0;
+}
 
 int main(int argc, char* argv[]) {
+    if (argc >= 4 && argc <= 6 && std::string(argv[1]) == "--validate") {
+        return validate(argv[2], argv[3], argc >= 5 ? std::atoi(argv[4]) : 1, argc == 6 ? argv[5] : nullptr);
+    }
+    if (argc == 2 && std::string(argv[1]) == "--selftest") {
+        if (!ARM7CPU::hle_math_selftest()) return 2;
+        std::cout << "BIOS math HLE matches every expected result" << std::endl;
+        return 0;
+    }
     if (argc != 2) {
         std::cout << "Usage: " << argv[0] << " <rom_file>" << std::endl;
+        std::cout << "       " << argv[0] << " --validate <cache|jit|tiered> <rom_file> [frames [idle_loops_file]]" << std::endl;
+        std::cout << "       " << argv[0] << " --selftest" << std::endl;
         return 1;
     }
 
     GBASystem gba;
     gba.init();
 
+    #ifdef DEBUG_TRACE
+    traced_system = &gba;
+    std::signal(SIGSEGV, dump_trace_on_crash);
+    std::signal(SIGABRT, dump_trace_on_crash);
+    std::signal(SIGFPE, dump_trace_on_crash);
+    std::signal(SIGILL, dump_trace_on_crash);
+    #endif
+
     if (!gba.load_rom(argv[1])) {
         return 1;
     }
@@ -1,5 +1,7 @@
 // memory/memory.cpp
 #include "memory.h"
+#include "../system.h"
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -13,6 +15,7 @@ uint32_t GBAMemory::read32(uint32_t address) const {
     } else if (address >= IWRAM_START && address < IWRAM_START + IWRAM_SIZE) {
         return *reinterpret_cast<const uint32_t*>(&iwram[address - IWRAM_START]);
     } else if (address >= IO_START && address < IO_START + IO_SIZE) {
+        if (system) return system->read_io_register32(address);
         return *reinterpret_cast<const uint32_t*>(&io_registers[address - IO_START]);
     } else if (address >= PALETTE_START && address < PALETTE_START + PALETTE_SIZE) {
         return *reinterpret_cast<const uint32_t*>(&palette[address - PALETTE_START]);
@@ -39,14 +42,19 @@ uint8_t GBAMemory::read8(uint32_t address) const {
 
 void GBAMemory::write32(uint32_t address, uint32_t value) {
     address &= ~3;
+    if (write_log) write_log->push_back({address, value, 4});
 
     if (address >= EWRAM_START && address < EWRAM_START + EWRAM_SIZE) {
         *reinterpret_cast<uint32_t*>(&ewram[address - EWRAM_START]) = value;
+        const uint32_t page = (address - EWRAM_START) >> CODE_PAGE_SHIFT;
+        if (is_code_page(page)) invalidate_code_page(page);
     } else if (address >= IWRAM_START && address < IWRAM_START + IWRAM_SIZE) {
         *reinterpret_cast<uint32_t*>(&iwram[address - IWRAM_START]) = value;
+        const uint32_t page = EWRAM_CODE_PAGES + ((address - IWRAM_START) >> CODE_PAGE_SHIFT);
+        if (is_code_page(page)) invalidate_code_page(page);
     } else if (address >= IO_START && address < IO_START + IO_SIZE) {
         *reinterpret_cast<uint32_t*>(&io_registers[address - IO_START]) = value;
-        // TODO: Handle I/O register writes (some have special behavior)
+        if (system) system->write_io_register32(address, value);
     } else if (address >= PALETTE_START && address < PALETTE_START + PALETTE_SIZE) {
         *reinterpret_cast<uint32_t*>(&palette[address - PALETTE_START]) = value;
     } else if (address >= VRAM_START && address < VRAM_START + VRAM_SIZE) {
@@ -57,6 +65,15 @@ void GBAMemory::write32(uint32_t address, uint32_t value) {
 }
 
 void GBAMemory::write16(uint32_t address, uint16_t value) {
+    // I/O registers see the halfword itself; merging it into a word would re-write the neighbour
+    if ((address & ~1u) >= IO_START && (address & ~1u) < IO_START + IO_SIZE) {
+        address &= ~1u;
+        if (write_log) write_log->push_back({address, value, 2});
+        *reinterpret_cast<uint16_t*>(&io_registers[address - IO_START]) = value;
+        if (system) system->write_io_register16(address, value);
+        return;
+    }
+
     if (address & 1) {
         // Unaligned write - handle carefully
         uint32_t aligned_addr = address & ~3;
@@ -77,6 +94,13 @@ void GBAMemory::write16(uint32_t address, uint16_t value) {
 }
 
 void GBAMemory::write8(uint32_t address, uint8_t value) {
+    if (address >= IO_START && address < IO_START + IO_SIZE) {
+        if (write_log) write_log->push_back({address, value, 1});
+        io_registers[address - IO_START] = value;
+        if (system) system->write_io_register(address, value);
+        return;
+    }
+
     uint32_t aligned_addr = address & ~3;
     uint32_t old_value = read32(aligned_addr);
     uint32_t shift = (address & 3) * 8;
@@ -105,6 +129,14 @@ bool GBAMemory::load_rom(const std::string& filename) {
     return true;
 }
 
+uint64_t GBAMemory::rom_hash() const {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint8_t byte : rom) {
+        hash = (hash ^ byte) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
 void GBAMemory::reset() {
     ewram.fill(0);
     iwram.fill(0);
@@ -112,6 +144,158 @@ void GBAMemory::reset() {
     palette.fill(0);
     vram.fill(0);
     oam.fill(0);
+    code_pages.fill(0);
+}
+
+void GBAMemory::mark_code_page(uint32_t address) {
+    uint32_t page;
+    if (address >= EWRAM_START && address < EWRAM_START + EWRAM_SIZE) {
+        page = (address - EWRAM_START) >> CODE_PAGE_SHIFT;
+    } else if (address >= IWRAM_START && address < IWRAM_START + IWRAM_SIZE) {
+        page = EWRAM_CODE_PAGES + ((address - IWRAM_START) >> CODE_PAGE_SHIFT);
+    } else {
+        return; // BIOS and ROM cannot be written
+    }
+    code_pages[page >> 6] |= uint64_t(1) << (page & 63);
+}
+
+void GBAMemory::invalidate_code_page(uint32_t page) {
+    code_pages[page >> 6] &= ~(uint64_t(1) << (page & 63));
+
+    const uint32_t address = page < EWRAM_CODE_PAGES
+        ? EWRAM_START + (page << CODE_PAGE_SHIFT)
+        : IWRAM_START + ((page - EWRAM_CODE_PAGES) << CODE_PAGE_SHIFT);
+    if (system) system->cpu.invalidate_code(address);
+}
+
+const uint8_t* GBAMemory::code_region(uint32_t address, uint32_t& start, uint32_t& size) const {
+    if (address >= BIOS_START && address < BIOS_START + BIOS_SIZE) {
+        start = BIOS_START;
+        size = BIOS_SIZE;
+        return bios.data();
+    } else if (address >= EWRAM_START && address < EWRAM_START + EWRAM_SIZE) {
+        start = EWRAM_START;
+        size = EWRAM_SIZE;
+        return ewram.data();
+    } else if (address >= IWRAM_START && address < IWRAM_START + IWRAM_SIZE) {
+        start = IWRAM_START;
+        size = IWRAM_SIZE;
+        return iwram.data();
+    } else if (address >= ROM_START && address < ROM_START + rom.size()) {
+        // Only whole words are fetched directly; a trailing partial word goes through read32
+        start = ROM_START;
+        size = static_cast<uint32_t>(rom.size()) & ~3u;
+        return rom.data();
+    }
+
+    start = 0;
+    size = 0;
+    return nullptr;
+}
+
+const uint32_t* GBAMemory::ram_words(uint32_t address, uint32_t count) const {
+    address &= ~3u;
+    const uint32_t size = count * 4;
+    if (address >= EWRAM_START && address - EWRAM_START <= EWRAM_SIZE - size) {
+        return reinterpret_cast<const uint32_t*>(&ewram[address - EWRAM_START]);
+    } else if (address >= IWRAM_START && address - IWRAM_START <= IWRAM_SIZE - size) {
+        return reinterpret_cast<const uint32_t*>(&iwram[address - IWRAM_START]);
+    }
+    return nullptr;
+}
+
+uint32_t* GBAMemory::writable_ram_words(uint32_t address, uint32_t count) {
+    address &= ~3u;
+    const uint32_t size = count * 4;
+    uint32_t first_page;
+    uint8_t* words;
+    if (address >= EWRAM_START && address - EWRAM_START <= EWRAM_SIZE - size) {
+        first_page = (address - EWRAM_START) >> CODE_PAGE_SHIFT;
+        words = &ewram[address - EWRAM_START];
+    } else if (address >= IWRAM_START && address - IWRAM_START <= IWRAM_SIZE - size) {
+        first_page = EWRAM_CODE_PAGES + ((address - IWRAM_START) >> CODE_PAGE_SHIFT);
+        words = &iwram[address - IWRAM_START];
+    } else {
+        return nullptr;
+    }
+
+    // Regions start on page boundaries, so page numbers advance with the address
+    const uint32_t last_page = first_page + ((address + size - 1) >> CODE_PAGE_SHIFT) - (address >> CODE_PAGE_SHIFT);
+    for (uint32_t page = first_page; page <= last_page; page++) {
+        if (is_code_page(page)) return nullptr;
+    }
+    return reinterpret_cast<uint32_t*>(words);
+}
+
+void GBAMemory::store_block(uint32_t address, const uint8_t* data, uint32_t size, uint32_t unit) {
+    address &= ~(unit - 1);
+    size &= ~(unit - 1);
+    if (size == 0) return;
+
+    // Whether the whole range lies in the region of region_size bytes at start
+    auto inside = [&](uint32_t start, size_t region_size) {
+        return address >= start && size <= region_size && address - start <= region_size - size;
+    };
+
+    uint8_t* target = nullptr;
+    uint32_t first_page = 0;
+    bool code = false;
+    if (inside(EWRAM_START, EWRAM_SIZE)) {
+        target = &ewram[address - EWRAM_START];
+        first_page = (address - EWRAM_START) >> CODE_PAGE_SHIFT;
+        code = true;
+    } else if (inside(IWRAM_START, IWRAM_SIZE)) {
+        target = &iwram[address - IWRAM_START];
+        first_page = EWRAM_CODE_PAGES + ((address - IWRAM_START) >> CODE_PAGE_SHIFT);
+        code = true;
+    } else if (inside(PALETTE_START, PALETTE_SIZE)) {
+        target = &palette[address - PALETTE_START];
+    } else if (inside(VRAM_START, VRAM_SIZE)) {
+        target = &vram[address - VRAM_START];
+    } else if (inside(OAM_START, OAM_SIZE)) {
+        target = &oam[address - OAM_START];
+    }
+
+    if (!target) {
+        for (uint32_t offset = 0; offset < size; offset += unit) {
+            if (unit == 4) {
+                uint32_t word;
+                std::memcpy(&word, data + offset, 4);
+                write32(address + offset, word);
+            } else if (unit == 2) {
+                write16(address + offset, static_cast<uint16_t>(data[offset] | (data[offset + 1] << 8)));
+            } else {
+                write8(address + offset, data[offset]);
+            }
+        }
+        return;
+    }
+
+    std::memcpy(target, data, size);
+    if (write_log) {
+        // Every word the copy touched, as it now stands (the regions are whole words)
+        const uint8_t* word = target - (address & 3);
+        for (uint32_t word_address = address & ~3u; word_address < address + size; word_address += 4, word += 4) {
+            uint32_t value;
+            std::memcpy(&value, word, 4);
+            write_log->push_back({word_address, value, 4});
+        }
+    }
+    if (code) {
+        const uint32_t last_page = first_page + ((address + size - 1) >> CODE_PAGE_SHIFT) - (address >> CODE_PAGE_SHIFT);
+        for (uint32_t page = first_page; page <= last_page; page++) {
+            if (is_code_page(page)) invalidate_code_page(page);
+        }
+    }
+}
+
+void GBAMemory::log_ram_words(uint32_t address, uint32_t count) {
+    const uint32_t* words = ram_words(address, count);
+    if (!write_log || !words) return;
+    address &= ~3u;
+    for (uint32_t i = 0; i < count; i++) {
+        write_log->push_back({address + i * 4, words[i], 4});
+    }
 }
 
 bool GBAMemory::is_readable(uint32_t address) const {
@@ -26,9 +26,29 @@ constexpr uint32_t VRAM_START = 0x06000000;
 constexpr uint32_t OAM_START = 0x07000000;
 constexpr uint32_t ROM_START = 0x08000000;
 
+// Cached code is tracked per 1KB page of EWRAM (pages 0-255) and IWRAM (pages 256-287)
+constexpr uint32_t CODE_PAGE_SHIFT = 10;
+constexpr uint32_t EWRAM_CODE_PAGES = EWRAM_SIZE >> CODE_PAGE_SHIFT;
+constexpr uint32_t CODE_PAGE_COUNT = EWRAM_CODE_PAGES + (IWRAM_SIZE >> CODE_PAGE_SHIFT);
+
+class GBASystem;
+
+// One store, as recorded in GBAMemory::write_log. RAM stores of any size are recorded as the
+// word they produce; I/O stores keep their own size.
+struct MemoryWrite {
+    uint32_t address;
+    uint32_t value;
+    uint8_t size;
+
+    bool operator==(const MemoryWrite& other) const = default;
+};
+
 // Memory Management Unit
 class GBAMemory {
 public:
+    // Owning system; I/O accesses are forwarded to its register handlers
+    GBASystem* system = nullptr;
+
     std::array<uint8_t, BIOS_SIZE> bios{};
     std::array<uint8_t, EWRAM_SIZE> ewram{};
     std::array<uint8_t, IWRAM_SIZE> iwram{};
@@ -38,6 +58,14 @@ public:
     std::array<uint8_t, OAM_SIZE> oam{};
     std::vector<uint8_t> rom;
 
+    // Set for pages that cached code was decoded from; writes to them invalidate that code
+    std::array<uint64_t, (CODE_PAGE_COUNT + 63) / 64> code_pages{};
+
+    // When set, every store is appended here (lockstep validation). Stores that bypass write32
+    // (translated code, block transfers, store_block) record the words they wrote through
+    // log_ram_words, so they keep their fast paths while logged.
+    std::vector<MemoryWrite>* write_log = nullptr;
+
     uint32_t read32(uint32_t address) const;
     uint16_t read16(uint32_t address) const;
     uint8_t read8(uint32_t address) const;
@@ -47,8 +75,38 @@ public:
     bool load_rom(const std::string& filename);
     void reset();
 
+    // FNV-1a hash of the loaded ROM, identifying it across instances
+    uint64_t rom_hash() const;
+
+    // Host pointer to the region that code at address can run from (BIOS, EWRAM, IWRAM, ROM),
+    // with start/size describing it; nullptr and size 0 elsewhere
+    const uint8_t* code_region(uint32_t address, uint32_t& start, uint32_t& size) const;
+
+    // Host pointers to count words from address (aligned down) when they all lie in one of EWRAM
+    // or IWRAM, for block transfers; nullptr otherwise. The writable form also refuses ranges
+    // that cover cached code, as stores through it bypass write32's invalidation.
+    const uint32_t* ram_words(uint32_t address, uint32_t count) const;
+    uint32_t* writable_ram_words(uint32_t address, uint32_t count);
+
+    // Append count words from address (aligned down) to write_log as they now stand, for stores
+    // made through writable_ram_words or by translated code. Does nothing outside EWRAM/IWRAM.
+    void log_ram_words(uint32_t address, uint32_t count);
+
+    // Store size bytes of data from address on as consecutive unit-byte stores (1, 2 or 4), as
+    // the BIOS decompressors write. address is aligned down to unit and a trailing partial unit
+    // is dropped. A range inside one of EWRAM, IWRAM, palette, VRAM or OAM is copied straight
+    // into the backing array, and write_log then gets each word touched; anything else goes
+    // through write8/write16/write32.
+    void store_block(uint32_t address, const uint8_t* data, uint32_t size, uint32_t unit);
+
+    // Flag the page holding address (if it is in EWRAM or IWRAM) as containing cached code
+    void mark_code_page(uint32_t address);
+
 private:
     // Helper functions for memory region detection
     bool is_readable(uint32_t address) const;
     bool is_writable(uint32_t address) const;
+
+    bool is_code_page(uint32_t page) const { return (code_pages[page >> 6] >> (page & 63)) & 1; }
+    void invalidate_code_page(uint32_t page);
 };
\ No newline at end of file
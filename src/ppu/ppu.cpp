@@ -23,6 +23,7 @@ void GBAPPU::init() {
     vcount = 0;
     scanline = 0;
     dot = 0;
+    dot_cycles = 0;
 
     // Clear background control registers
     bg_control.fill(0);
@@ -91,6 +92,19 @@ void GBAPPU::step(GBASystem& gba) {
     }
 }
 
+void GBAPPU::advance(GBASystem& gba, int cycles) {
+    dot_cycles += cycles;
+    while (dot_cycles >= CYCLES_PER_DOT) {
+        dot_cycles -= CYCLES_PER_DOT;
+        step(gba);
+    }
+}
+
+int GBAPPU::cycles_until_event() const {
+    const int event_dot = dot < 240 ? 240 : DOTS_PER_SCANLINE;
+    return (event_dot - dot) * CYCLES_PER_DOT - dot_cycles;
+}
+
 void GBAPPU::render_scanline(GBASystem& gba) {
     // Skip rendering if forced blank is enabled
     if (dispcnt & DISPCNT_FORCED_BLANK) {
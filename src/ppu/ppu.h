@@ -12,6 +12,7 @@ constexpr int GBA_SCREEN_WIDTH = 240;
 constexpr int GBA_SCREEN_HEIGHT = 160;
 constexpr int DOTS_PER_SCANLINE = 308;
 constexpr int TOTAL_SCANLINES = 228;
+constexpr int CYCLES_PER_DOT = 4;
 
 // Display Control Register bits
 constexpr uint16_t DISPCNT_BG_MODE_MASK = 0x0007;
@@ -40,10 +41,16 @@ public:
     std::array<uint16_t, 4> bg_scroll_y{};   // Background Y Scroll
     int scanline = 0;
     int dot = 0;
+    int dot_cycles = 0;            // CPU cycles accumulated towards the next dot
     std::array<uint32_t, GBA_SCREEN_WIDTH * GBA_SCREEN_HEIGHT> framebuffer{};
 
     void init();
     void step(GBASystem& gba);
+
+    // Cycle-driven stepping: advance by elapsed CPU cycles, and how many cycles remain
+    // until the next dot that can raise an interrupt (H-Blank start or end of line)
+    void advance(GBASystem& gba, int cycles);
+    int cycles_until_event() const;
     void render_scanline(GBASystem& gba);
 
 private:
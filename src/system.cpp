@@ -1,9 +1,19 @@
 // system.cpp
 #include "system.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
 GBASystem::GBASystem()
     : running(false), cycles(0), interrupt_enable(0), interrupt_flags(0), interrupt_master(0) {
+    memory.system = this;
+}
+
+GBASystem::~GBASystem() {
+    // The predecoder reads the ROM, which is destroyed before the CPU
+    cpu.stop_predecode();
 }
 
 void GBASystem::init() {
@@ -20,14 +30,56 @@ void GBASystem::reset() {
 }
 
 bool GBASystem::load_rom(const std::string& filename) {
-    return memory.load_rom(filename);
+    cpu.stop_predecode();
+    if (!memory.load_rom(filename)) return false;
+
+    // The ROM buffer may have moved; restart the CPU so it refetches from the new cartridge
+    cpu.reset();
+    if (cpu.hle_bios) cpu.install_hle_bios(*this);
+    if (cpu.predecode_rom) cpu.start_predecode(*this);
+    return true;
+}
+
+bool GBASystem::load_idle_loops(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) return false;
+
+    // The game code sits in the cartridge header at 0xAC
+    const std::string game_code = memory.rom.size() >= 0xB0
+        ? std::string(reinterpret_cast<const char*>(&memory.rom[0xAC]), 4) : std::string();
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(memory.rom_hash()));
+
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || (key != game_code && key != hash)) continue;
+
+        uint32_t address;
+        while (fields >> std::hex >> address) {
+            cpu.idle_loop_addresses.insert(address & ~1u);  // Thumb entry points may carry bit 0
+        }
+    }
+
+    #ifdef DEBUG_IDLE_LOOPS
+    std::cout << "Idle loops: " << cpu.idle_loop_addresses.size() << " addresses for " << hash << std::endl;
+    #endif
+
+    return true;
 }
 
 void GBASystem::run_frame() {
-    // Run for approximately one frame (about 280,896 cycles)
-    for (int i = 0; i < 280896 && running; i++) {
-        cpu.step(*this);
-        ppu.step(*this);
+    // Run for one frame (280,896 cycles). The CPU runs up to the next PPU event, then the
+    // PPU catches up; the CPU cannot observe that event any earlier.
+    int frame_cycles = 0;
+    while (frame_cycles < CYCLES_PER_FRAME && running) {
+        const int budget = std::min(ppu.cycles_until_event(), CYCLES_PER_FRAME - frame_cycles);
+        const int elapsed = cpu.run(*this, budget);
+        ppu.advance(*this, elapsed);
+        frame_cycles += elapsed;
+        cycles += elapsed;
     }
 }
 
@@ -62,6 +114,13 @@ bool GBASystem::has_pending_interrupts() const {
     return (interrupt_flags & interrupt_enable) != 0;
 }
 
+bool GBASystem::wakes_cpu() const {
+    // Unlike taking the IRQ, waking up ignores IME
+    uint16_t requested = interrupt_flags & interrupt_enable;
+    if (cpu.power_state == PowerState::STOP) requested &= STOP_WAKE_INTERRUPTS;
+    return requested != 0;
+}
+
 void GBASystem::handle_interrupt() {
     // Tell CPU to handle the interrupt
     cpu.handle_irq(*this);
@@ -108,6 +167,8 @@ uint8_t GBASystem::read_io_register(uint32_t address) {
             #ifdef DEBUG_IO
             std::cout << "Unhandled I/O read from 0x" << std::hex << address << std::endl;
             #endif
+            // Registers without side effects read back what was last written
+            if (address - IO_START < IO_SIZE) return memory.io_registers[address - IO_START];
             return 0;
     }
 }
@@ -162,7 +223,21 @@ uint32_t GBASystem::read_io_register32(uint32_t address) {
     }
 }
 
+// Writes that can raise or mask an interrupt, or change when the next one happens
+static bool is_timing_register(uint32_t address, uint32_t size) {
+    const auto overlaps = [&](uint32_t start, uint32_t end) {
+        return address < end && address + size > start;
+    };
+    return overlaps(0x04000004, 0x04000006) ||  // DISPSTAT
+           overlaps(0x040000B0, 0x040000E0) ||  // DMA
+           overlaps(0x04000100, 0x04000110) ||  // Timers
+           overlaps(REG_IE, REG_IME + 4) ||     // IE, IF, IME
+           overlaps(0x04000300, 0x04000302);    // POSTFLG, HALTCNT
+}
+
 void GBASystem::write_io_register(uint32_t address, uint8_t value) {
+    if (is_timing_register(address, 1)) cpu.yield_requested = true;
+
     switch (address) {
         case REG_IE:
             interrupt_enable = (interrupt_enable & 0xFF00) | value;
@@ -203,6 +278,15 @@ void GBASystem::write_io_register(uint32_t address, uint8_t value) {
             ppu.dispstat = (ppu.dispstat & 0x00FF) | (value << 8);
             break;
 
+        case REG_HALTCNT:
+            // Takes effect once the storing instruction completes: the write yields, and run()
+            // sleeps from the next slice on
+            cpu.power_state = (value & 0x80) ? PowerState::STOP : PowerState::HALT;
+            #ifdef DEBUG_INTERRUPTS
+            std::cout << ((value & 0x80) ? "CPU stopped" : "CPU halted") << std::endl;
+            #endif
+            break;
+
         default:
             #ifdef DEBUG_IO
             std::cout << "Unhandled I/O write to 0x" << std::hex << address
@@ -213,6 +297,8 @@ void GBASystem::write_io_register(uint32_t address, uint8_t value) {
 }
 
 void GBASystem::write_io_register16(uint32_t address, uint16_t value) {
+    if (is_timing_register(address, 2)) cpu.yield_requested = true;
+
     switch (address) {
         case REG_IE:
             interrupt_enable = value;
@@ -258,6 +344,8 @@ void GBASystem::write_io_register16(uint32_t address, uint16_t value) {
 }
 
 void GBASystem::write_io_register32(uint32_t address, uint32_t value) {
+    if (is_timing_register(address, 4)) cpu.yield_requested = true;
+
     switch (address) {
         case REG_IME:
             interrupt_master = value;
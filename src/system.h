@@ -23,10 +23,17 @@ enum GBAInterrupt {
     IRQ_GAMEPAK = 13    // Game Pak (external IRQ)
 };
 
+// One frame is 228 scanlines of 1232 cycles
+constexpr int CYCLES_PER_FRAME = 280896;
+
 // I/O Register addresses for interrupts
 constexpr uint32_t REG_IE = 0x04000200;    // Interrupt Enable
 constexpr uint32_t REG_IF = 0x04000202;    // Interrupt Request Flags
 constexpr uint32_t REG_IME = 0x04000208;   // Interrupt Master Enable
+constexpr uint32_t REG_HALTCNT = 0x04000301;    // Low-power mode control
+
+// Interrupts that end PowerState::STOP; any enabled interrupt ends PowerState::HALT
+constexpr uint16_t STOP_WAKE_INTERRUPTS = (1 << IRQ_SERIAL) | (1 << IRQ_KEYPAD) | (1 << IRQ_GAMEPAK);
 
 class GBASystem {
 public:
@@ -44,15 +51,25 @@ public:
     uint32_t interrupt_master;      // IME register
 
     GBASystem();
+    ~GBASystem();
 
     void init();
     void reset();
     bool load_rom(const std::string& filename);
     void run_frame();
 
+    // Read per-ROM idle loop addresses (ARM7CPU::idle_loop_addresses) for the loaded ROM. Each
+    // line is a 4-character game code or a 16-digit GBAMemory::rom_hash(), then the addresses
+    // of the loops' first instructions in hex; '#' starts a comment. False if unreadable. Call it
+    // after load_rom() and before running or loading a code cache, as code translated earlier
+    // may already link to the loops.
+    bool load_idle_loops(const std::string& filename);
+
     void request_interrupt(int interrupt_type);
     void check_interrupts();
     [[nodiscard]] bool has_pending_interrupts() const;
+    // Whether a requested interrupt ends the CPU's current low-power state
+    [[nodiscard]] bool wakes_cpu() const;
 
     // I/O register access
     uint8_t read_io_register(uint32_t address);